@@ -1,2 +1,6 @@
+# the network evaluation has AVX2 kernels: use them if this machine has AVX2
+ARCH="-msse4.2"
+grep -qw avx2 /proc/cpuinfo 2>/dev/null && ARCH="-mavx2"
+
 g++ ./src/*.cc -o $1 -std=c++11 -Wall -Wextra -pedantic -Wshadow -DNDEBUG \
-	-O3 -msse4.2 -fno-rtti -flto -s
+	-O3 ${ARCH} -fno-rtti -flto -s -pthread
@@ -0,0 +1,183 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+*/
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "analyse.h"
+#include "search.h"
+#include "uci.h"
+
+using namespace std::chrono;
+
+namespace {
+
+// Input file, shared by all jobs
+std::ifstream epd;
+std::mutex epd_mtx;
+uint64_t position_count, total_nodes;
+
+std::mutex output_mtx;
+
+bool next_position(std::string& fen, std::string& id)
+/* Reads the next position from the EPD file: the 4 FEN fields, followed by operations (eg.
+ * 'bm Nf3; id "WAC.001";'). Full FEN lines (with move counters) are also accepted. Only the id
+ * operation is kept. Returns false at the end of the file. */
+{
+	std::lock_guard<std::mutex> lock(epd_mtx);
+	std::string line, field;
+
+	while (getline(epd, line)) {
+		std::istringstream is(line);
+		fen.clear();
+		id.clear();
+
+		int fields = 0;
+		while (fields < 4 && is >> field) {
+			fen += field + ' ';
+			++fields;
+		}
+		if (fields < 4 || line[0] == '#')
+			continue;	// empty line, or comment
+
+		// FEN move counters
+		while (is >> field && field.find_first_not_of("0123456789") == std::string::npos)
+			fen += field + ' ';
+
+		const size_t i = line.find("id \"");
+		if (i != std::string::npos)
+			id = line.substr(i + 3, line.find('"', i + 4) - (i + 3) + 1);
+
+		return true;
+	}
+
+	return false;
+}
+
+std::string epd_result(const std::string& fen, const std::string& id, const search::Result& r)
+// Result line: the position followed by EPD operations (moves in coordinate notation)
+{
+	std::ostringstream os;
+
+	std::istringstream is(fen);
+	std::string field;
+	for (int i = 0; i < 4 && is >> field; ++i)
+		os << field << ' ';
+
+	if (!id.empty())
+		os << "id " << id << "; ";
+
+	if (!r.best)
+		os << "c0 \"no legal move\";";
+	else {
+		os << "acd " << r.depth << "; acn " << r.nodes << "; ";
+
+		if (r.score >= MATE - MAX_PLY)
+			os << "dm " << (MATE - r.score + 1) / 2;
+		else if (r.score <= -MATE + MAX_PLY)
+			os << "dm " << -(r.score + MATE + 1) / 2;
+		else
+			os << "ce " << r.score;
+
+		os << "; bm " << move::move_to_string(r.best) << "; pv";
+		for (auto m : r.pv)
+			os << ' ' << move::move_to_string(m);
+		os << ';';
+	}
+
+	return os.str();
+}
+
+void job(const search::Limits& sl, int hash)
+/* Each job has its own search context (TT, etc.): jobs share nothing but the input and output. The
+ * TT is kept between positions: clearing it would dominate the time of small searches. */
+{
+	search::Context ctx;
+	ctx.uci_output = false;
+	ctx.TT.alloc((uint64_t)hash << 20);
+
+	board::Board B;
+	std::string fen, id;
+
+	while (next_position(fen, id)) {
+		B.set_fen(fen);
+		const search::Result r = ctx.bestmove(B, sl);
+
+		std::lock_guard<std::mutex> lock(output_mtx);
+		std::cout << epd_result(fen, id, r) << std::endl;
+		++position_count;
+		total_nodes += r.nodes;
+	}
+}
+
+}	// namespace
+
+void analyse(int argc, char **argv)
+{
+	if (argc < 3) {
+		std::cerr << "usage: " << argv[0] << " analyse <file.epd> [--depth d] [--nodes n]"
+			" [--movetime ms] [--jobs n] [--hash mb]" << std::endl;
+		return;
+	}
+
+	epd.open(argv[2]);
+	if (!epd.is_open()) {
+		std::cerr << "cannot open " << argv[2] << std::endl;
+		return;
+	}
+
+	search::Limits sl;
+	int jobs = 1, hash = uci::Hash;
+
+	for (int i = 3; i + 1 < argc; i += 2) {
+		const std::string option(argv[i]);
+		if (option == "--depth")
+			sl.depth = std::atoi(argv[i + 1]);
+		else if (option == "--nodes")
+			sl.nodes = std::strtoull(argv[i + 1], nullptr, 10);
+		else if (option == "--movetime")
+			sl.movetime = std::atoi(argv[i + 1]);
+		else if (option == "--jobs")
+			jobs = std::max(std::atoi(argv[i + 1]), 1);
+		else if (option == "--hash")
+			hash = std::max(std::atoi(argv[i + 1]), 1);
+	}
+
+	if (!sl.depth && !sl.nodes && !sl.movetime)
+		sl.depth = 12;
+
+	// each job searches with one thread, and scores are objective
+	uci::Threads = 1;
+	uci::MultiPV = 1;
+	uci::Contempt = 0;
+
+	const auto start = high_resolution_clock::now();
+
+	std::vector<std::thread> pool;
+	for (int i = 0; i < jobs; ++i)
+		pool.emplace_back(job, sl, hash);
+	for (auto& t : pool)
+		t.join();
+
+	const int64_t elapsed_usec = duration_cast<microseconds>(high_resolution_clock::now() - start).count();
+	std::cerr << "positions = " << position_count << std::endl;
+	std::cerr << "time (ms) = " << elapsed_usec / 1000 << std::endl;
+	std::cerr << "nodes = " << total_nodes << std::endl;
+	std::cerr << "kn/s = " << total_nodes / (double)elapsed_usec * 1e3 << std::endl;
+}
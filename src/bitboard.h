@@ -37,6 +37,12 @@ extern Key zob_ep(int sq);
 extern Key zob_castle(int crights);
 extern Key zob_turn();
 
+// Polyglot keys (opening books): fixed constants, unlike the above
+extern Key pg_zob(int c, int p, int sq);
+extern Key pg_zob_ep(int f);
+extern Key pg_zob_castle(int crights);	// crights uses the same bits as the Board (OO << 2 * color)
+extern Key pg_zob_turn();	// when White is to move
+
 extern Bitboard between(int s1, int s2);	// excludes s1 and includes s2
 extern Bitboard direction(int s1, int s2);	// so through s2 to the edge of the board
 
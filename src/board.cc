@@ -35,11 +35,41 @@ void Board::clear()
 	sp = sp0 = game_stack;
 	std::memset(sp, 0, sizeof(UndoInfo));
 	sp->epsq = NO_SQUARE;
+	dp = derived;
+	dp->valid = dp->ply = 0;
 	move_count = 1;
 
 	initialized = true;
 }
 
+Board& Board::operator= (const Board& other)
+/* sp and sp0 point into game_stack, so a memberwise copy would leave them pointing into the other
+ * Board's stack. Copy only the used part of the stack, and rebase the pointers. */
+{
+	initialized = other.initialized;
+	if (this == &other || !initialized)
+		return *this;
+
+	std::memcpy(b, other.b, sizeof(b));
+	std::memcpy(all, other.all, sizeof(all));
+	std::memcpy(piece_on, other.piece_on, sizeof(piece_on));
+
+	sp = game_stack + (other.sp - other.game_stack);
+	sp0 = game_stack + (other.sp0 - other.game_stack);
+	std::memcpy(game_stack, other.game_stack, (sp - game_stack + 1) * sizeof(UndoInfo));
+	dp = derived + (other.dp - other.derived);
+	std::memcpy(derived, other.derived, sizeof(derived));
+	if (!other.accumulators.empty())
+		accumulators = other.accumulators;
+
+	turn = other.turn;
+	king_pos[WHITE] = other.king_pos[WHITE];
+	king_pos[BLACK] = other.king_pos[BLACK];
+	move_count = other.move_count;
+
+	return *this;
+}
+
 void Board::set_fen(const std::string& _fen)
 {
 	clear();
@@ -92,14 +122,31 @@ void Board::set_fen(const std::string& _fen)
 
 	fen >> std::skipws >> sp->rule50 >> move_count;
 
-	const int us = turn, them = opp_color(us);
-	sp->pinned = hidden_checkers(1, us);
-	sp->dcheckers = hidden_checkers(0, us);
+	assert(verify_keys());
+	assert(verify_psq());
+}
+
+void Board::set_pos(const int colors[NB_SQUARE], const int pieces[NB_SQUARE], int _turn, int crights,
+	int epsq, int rule50)
+{
+	clear();
+
+	for (int sq = A1; sq <= H8; ++sq)
+		if (pieces[sq] != NO_PIECE) {
+			set_square(colors[sq], pieces[sq], sq);
+			if (pieces[sq] == KING)
+				king_pos[colors[sq]] = sq;
+		}
 
-	calc_attacks(us);
-	sp->attacked = calc_attacks(them);
+	turn = _turn;
+	if (turn) {
+		sp->key ^= bb::zob_turn();
+		sp->kpkey ^= bb::zob_turn();
+	}
 
-	sp->checkers = bb::test_bit(st().attacked, king_pos[us]) ? calc_checkers(us) : 0ULL;
+	sp->crights = crights;
+	sp->epsq = epsq;
+	sp->rule50 = rule50;
 
 	assert(verify_keys());
 	assert(verify_psq());
@@ -184,12 +231,16 @@ void Board::play(move::move_t m)
 	assert(initialized);
 	++sp;
 	memcpy(sp, sp - 1, sizeof(UndoInfo));
+	dp = derived_at(sp - game_stack);
+	dp->valid = 0;
+	dp->ply = sp - game_stack;
 	sp->last_move = m;
 	sp->rule50++;
 
 	const int us = turn, them = opp_color(us);
 	const int fsq = m.fsq(), tsq = m.tsq();
 	const int piece = piece_on[fsq], capture = piece_on[tsq];
+	sp->moved = piece;
 
 	// Null move
 	if (!m) {
@@ -212,7 +263,8 @@ void Board::play(move::move_t m)
 		sp->rule50 = 0;
 		const int inc_pp = us ? -8 : 8;
 		// set the epsq if double push, and ep square is attacked by enemy pawns
-		sp->epsq = tsq == fsq + 2 * inc_pp && bb::test_bit(get_attacks(them, PAWN), fsq + inc_pp)
+		sp->epsq = tsq == fsq + 2 * inc_pp
+			&& (bb::pattacks(us, fsq + inc_pp) & get_pieces(them, PAWN))
 			? fsq + inc_pp : NO_SQUARE;
 		// capture en passant
 		if (m.flag() == move::EN_PASSANT)
@@ -261,13 +313,6 @@ move_played:
 	sp->kpkey ^= bb::zob_turn();
 
 	sp->capture = capture;
-	sp->pinned = hidden_checkers(1, them);
-	sp->dcheckers = hidden_checkers(0, them);
-
-	sp->attacked = calc_attacks(us);
-	calc_attacks(them);
-
-	sp->checkers = bb::test_bit(st().attacked, king_pos[them]) ? calc_checkers(them) : 0ULL;
 
 	assert(verify_keys());
 	assert(verify_psq());
@@ -319,45 +364,187 @@ move_undone:
 		--move_count;
 
 	--sp;
+	dp = derived_at(sp - game_stack);
+	if (dp->ply != sp - game_stack) {
+		dp->valid = 0;
+		dp->ply = sp - game_stack;
+	}
 
 	assert(verify_keys());
 	assert(verify_psq());
 }
 
-Bitboard Board::calc_attacks(int color) const
+Bitboard Board::calc_attacks(int color, int piece) const
+/* Squares attacked by the pieces of color and type piece. Queens are counted as bishops (diagonal
+ * attacks) and rooks (lateral attacks). */
 {
-	assert(initialized);
+	assert(initialized && color_ok(color));
 	Bitboard fss, r = 0;
 
-	// Pawn
-	fss = get_pieces(color, PAWN);
-	r |= sp->attacks[color][PAWN]
-		= bb::shift_bit((fss & ~bb::FileA_bb), color ? -NB_FILE - 1 : +NB_FILE - 1)
-		| bb::shift_bit((fss & ~bb::FileH_bb), color ? -NB_FILE + 1 : +NB_FILE + 1);
+	switch (piece) {
+	case PAWN:
+		fss = get_pieces(color, PAWN);
+		return bb::shift_bit((fss & ~bb::FileA_bb), color ? -NB_FILE - 1 : +NB_FILE - 1)
+			| bb::shift_bit((fss & ~bb::FileH_bb), color ? -NB_FILE + 1 : +NB_FILE + 1);
+	case KNIGHT:
+		fss = get_pieces(color, KNIGHT);
+		while (fss)
+			r |= bb::nattacks(bb::pop_lsb(&fss));
+		return r;
+	case BISHOP:
+		fss = get_BQ(color);
+		while (fss)
+			r |= bb::battacks(bb::pop_lsb(&fss), st().occ);
+		return r;
+	case ROOK:
+		fss = get_RQ(color);
+		while (fss)
+			r |= bb::rattacks(bb::pop_lsb(&fss), st().occ);
+		return r;
+	default:
+		assert(piece == KING);
+		return bb::kattacks(get_king_pos(color));
+	}
+}
+
+void Board::update_attacks(Bitboard *a, int color, int touched, Bitboard changed) const
+/* Updates the attacks of color, from the previous ply to the current one:
+ * - touched: mask of (1 << piece), for each piece type of color that was moved, captured, or promoted
+ *   to by the last move. Only these are recomputed, plus:
+ * - the sliders whose rays pass through a square that changed occupancy (changed). A slider's attacks
+ *   only depend on the occupancy of the squares it attacks, so the others are unaffected.
+ * A quiet move typically recomputes the moved piece only, and one or two slider sets. */
+{
+	if (touched & (1 << PAWN))
+		a[PAWN] = calc_attacks(color, PAWN);
+	if (touched & (1 << KNIGHT))
+		a[KNIGHT] = calc_attacks(color, KNIGHT);
+	if ((touched & (1 << BISHOP | 1 << QUEEN)) || (a[BISHOP] & changed))
+		a[BISHOP] = calc_attacks(color, BISHOP);
+	if ((touched & (1 << ROOK | 1 << QUEEN)) || (a[ROOK] & changed))
+		a[ROOK] = calc_attacks(color, ROOK);
+	if (touched & (1 << KING))
+		a[KING] = calc_attacks(color, KING);
+
+	a[NO_PIECE] = a[PAWN] | a[KNIGHT] | a[BISHOP] | a[ROOK] | a[KING];
+}
+
+void Board::calc_derived(int what) const
+{
+	const int us = turn, them = opp_color(us);
+	DerivedInfo& d = *dp;
+
+	if (what & DerivedInfo::PINS) {
+		d.pinned = hidden_checkers(1, us);
+		d.dcheckers = hidden_checkers(0, us);
+	}
+
+	if (what & DerivedInfo::ATTACKS) {
+		const move::move_t m = sp->last_move;
+
+		const DerivedInfo *prev = derived_at(d.ply - 1);
+		if (d.ply > 0 && prev->ply == d.ply - 1 && (prev->valid & DerivedInfo::ATTACKS)) {
+			// update the attacks of the previous ply (a null move changes nothing)
+			std::memcpy(d.attacks, prev->attacks, sizeof(d.attacks));
+
+			if (m) {
+				const int tsq = m.tsq(), piece = m.flag() == move::PROMOTION ? PAWN : piece_on[tsq];
+				const Bitboard changed = (sp - 1)->occ ^ sp->occ;
+
+				// them is the side that played m
+				update_attacks(d.attacks[them], them, 1 << piece | 1 << piece_on[tsq]
+					| (m.flag() == move::CASTLING ? 1 << ROOK : 0), changed);
+				update_attacks(d.attacks[us], us, (piece_ok(sp->capture) ? 1 << sp->capture : 0)
+					| (m.flag() == move::EN_PASSANT ? 1 << PAWN : 0), changed);
+			}
+		} else
+			for (int color = WHITE; color <= BLACK; ++color) {
+				Bitboard *a = d.attacks[color];
+				for (int piece = PAWN; piece <= KING; ++piece)
+					if (piece != QUEEN)
+						a[piece] = calc_attacks(color, piece);
+				a[NO_PIECE] = a[PAWN] | a[KNIGHT] | a[BISHOP] | a[ROOK] | a[KING];
+			}
+
+		d.checkers = bb::test_bit(d.attacks[them][NO_PIECE], king_pos[us]) ? calc_checkers(us) : 0ULL;
+	}
+
+	d.valid |= what;
+	assert(!(what & DerivedInfo::ATTACKS) || verify_attacks());
+}
+
+void Board::calc_accumulator() const
+/* Update the accumulator of the last ply that has one, by replaying the moves played since. A
+ * perspective is refreshed instead, if its King has moved (all its features change), or if there is
+ * no accumulator to start from, within MaxReplay plies. */
+{
+	static const int MaxReplay = 8;
+
+	if (accumulators.empty())
+		accumulators.resize(DerivedSize);
+
+	const int i = dp->ply;
+	int j = i - 1;
+	while (j >= 0 && i - j <= MaxReplay
+		&& !(derived_at(j)->ply == j && (derived_at(j)->valid & DerivedInfo::ACCUMULATOR)))
+		--j;
+	const bool found = j >= 0 && i - j <= MaxReplay;
+
+	for (int c = WHITE; c <= BLACK; ++c) {
+		int16_t *acc = accumulators[i & (DerivedSize - 1)].v[c];
+		bool refresh = !found;
+
+		// the move at ply k was played by the side not to move at ply k
+		for (int k = i; k > j && !refresh; --k)
+			refresh = game_stack[k].last_move && game_stack[k].moved == KING
+				&& ((i - k) & 1 ? turn : opp_color(turn)) == c;
 
-	// Knight
-	sp->attacks[color][KNIGHT] = 0;
-	fss = get_pieces(color, KNIGHT);
-	while (fss)
-		r |= sp->attacks[color][KNIGHT] |= bb::nattacks(bb::pop_lsb(&fss));
+		if (refresh) {
+			nnue::refresh(*this, c, acc);
+			continue;
+		}
 
-	// Bishop + Queen (diagonal)
-	sp->attacks[color][BISHOP] = 0;
-	fss = get_BQ(color);
-	while (fss)
-		r |= sp->attacks[color][BISHOP] |= bb::battacks(bb::pop_lsb(&fss), st().occ);
+		const int16_t *from = accumulators[j & (DerivedSize - 1)].v[c];
+		std::memcpy(acc, from, nnue::L1 * sizeof(*from));
+		const int ksq = king_pos[c];
+
+		for (int k = j + 1; k <= i; ++k) {
+			const UndoInfo& u = game_stack[k];
+			const move::move_t m = u.last_move;
+			if (!m)
+				continue;
+
+			const int us = (i - k) & 1 ? turn : opp_color(turn), them = opp_color(us);
+			const int fsq = m.fsq(), tsq = m.tsq();
+
+			if (u.moved != KING) {
+				nnue::sub_feature(acc, nnue::feature(c, ksq, us, u.moved, fsq));
+				nnue::add_feature(acc, nnue::feature(c, ksq, us,
+					m.flag() == move::PROMOTION ? m.prom() : u.moved, tsq));
+			} else if (m.flag() == move::CASTLING) {
+				const int rfsq = tsq > fsq ? (us ? H8 : H1) : (us ? A8 : A1);
+				const int rtsq = tsq > fsq ? (us ? F8 : F1) : (us ? D8 : D1);
+				nnue::sub_feature(acc, nnue::feature(c, ksq, us, ROOK, rfsq));
+				nnue::add_feature(acc, nnue::feature(c, ksq, us, ROOK, rtsq));
+			}
 
-	// Rook + Queen (lateral)
-	sp->attacks[color][ROOK] = 0;
-	fss = get_RQ(color);
-	while (fss)
-		r |= sp->attacks[color][ROOK] |= bb::rattacks(bb::pop_lsb(&fss), st().occ);
+			if (m.flag() == move::EN_PASSANT)
+				nnue::sub_feature(acc, nnue::feature(c, ksq, them, PAWN, bb::pawn_push(them, tsq)));
+			else if (piece_ok(u.capture))
+				nnue::sub_feature(acc, nnue::feature(c, ksq, them, u.capture, tsq));
+		}
+	}
 
-	// King
-	r |= sp->attacks[color][KING] = bb::kattacks(get_king_pos(color));
+	dp->valid |= DerivedInfo::ACCUMULATOR;
+	assert(verify_accumulator());
+}
 
-	//All
-	return sp->attacks[color][NO_PIECE] = r;
+const nnue::Accumulator& Board::get_accumulator() const
+{
+	assert(nnue::enabled());
+	if (!(dp->valid & DerivedInfo::ACCUMULATOR))
+		calc_accumulator();
+	return accumulators[dp - derived];
 }
 
 Bitboard Board::hidden_checkers(bool find_pins, int color) const
@@ -467,6 +654,38 @@ bool Board::verify_keys() const
 	return key == st().key && kpkey == st().kpkey && mat_key == st().mat_key;
 }
 
+bool Board::verify_accumulator() const
+// Accumulator, as calculated by calc_accumulator(), against a full recomputation
+{
+	nnue::Accumulator a;
+	for (int c = WHITE; c <= BLACK; ++c)
+		nnue::refresh(*this, c, a.v[c]);
+
+	return !std::memcmp(&a, &accumulators[dp - derived], sizeof(a));
+}
+
+bool Board::verify_attacks() const
+// Attacks, as calculated by calc_derived(), against a full recomputation
+{
+	const DerivedInfo& d = *dp;
+
+	for (int color = WHITE; color <= BLACK; ++color) {
+		Bitboard all_attacks = 0;
+		for (int piece = PAWN; piece <= KING; ++piece)
+			if (piece != QUEEN) {
+				const Bitboard a = calc_attacks(color, piece);
+				if (a != d.attacks[color][piece])
+					return false;
+				all_attacks |= a;
+			}
+
+		if (all_attacks != d.attacks[color][NO_PIECE])
+			return false;
+	}
+
+	return true;
+}
+
 bool Board::verify_psq() const
 {
 	Eval psq[NB_COLOR];
@@ -582,7 +801,27 @@ Bitboard Board::get_attacks(int color, int piece) const
 {
 	assert(color_ok(color));
 	assert(PAWN <= piece && piece <= NO_PIECE && piece != QUEEN);
-	return st().attacks[color][piece];
+	return get_derived(DerivedInfo::ATTACKS).attacks[color][piece];
+}
+
+Bitboard Board::get_attacked() const
+{
+	return get_derived(DerivedInfo::ATTACKS).attacks[opp_color(turn)][NO_PIECE];
+}
+
+Bitboard Board::get_checkers() const
+{
+	return get_derived(DerivedInfo::ATTACKS).checkers;
+}
+
+Bitboard Board::get_pinned() const
+{
+	return get_derived(DerivedInfo::PINS).pinned;
+}
+
+Bitboard Board::get_dcheckers() const
+{
+	return get_derived(DerivedInfo::PINS).dcheckers;
 }
 
 int Board::get_turn() const
@@ -668,6 +907,70 @@ Key Board::get_key() const
 		^ bb::zob_castle(st().crights);
 }
 
+Key Board::key_after(move::move_t m, Key& kpkey) const
+/* Same keys as play(m) then get_key() and st().kpkey, but much cheaper: only the key updates of play()
+ * are done, without touching the board. m can be a null move. */
+{
+	assert(initialized);
+	const int us = turn, them = opp_color(us);
+	Key key = st().key ^ bb::zob_turn();
+	kpkey = st().kpkey ^ bb::zob_turn();
+	int crights = st().crights, epsq = NO_SQUARE;
+
+	if (m) {
+		const int fsq = m.fsq(), tsq = m.tsq();
+		const int piece = piece_on[fsq], capture = piece_on[tsq];
+
+		key ^= bb::zob(us, piece, fsq) ^ bb::zob(us, m.flag() == move::PROMOTION ? m.prom() : piece, tsq);
+
+		if (piece_ok(capture)) {
+			key ^= bb::zob(them, capture, tsq);
+			if (capture == PAWN)
+				kpkey ^= bb::zob(them, PAWN, tsq);
+			else if (capture == ROOK) {
+				if (tsq == (us ? H1 : H8))
+					crights &= ~(OO << (2 * them));
+				else if (tsq == (us ? A1 : A8))
+					crights &= ~(OOO << (2 * them));
+			}
+		}
+
+		if (piece == PAWN) {
+			const int inc_pp = us ? -8 : 8;
+			kpkey ^= bb::zob(us, PAWN, fsq);
+			if (m.flag() != move::PROMOTION)
+				kpkey ^= bb::zob(us, PAWN, tsq);
+
+			if (tsq == fsq + 2 * inc_pp && (bb::pattacks(us, fsq + inc_pp) & get_pieces(them, PAWN)))
+				epsq = fsq + inc_pp;
+			else if (m.flag() == move::EN_PASSANT) {
+				key ^= bb::zob(them, PAWN, tsq - inc_pp);
+				kpkey ^= bb::zob(them, PAWN, tsq - inc_pp);
+			}
+		} else if (piece == ROOK) {
+			if (fsq == (us ? H8 : H1))
+				crights &= ~(OO << (2 * us));
+			else if (fsq == (us ? A8 : A1))
+				crights &= ~(OOO << (2 * us));
+		} else if (piece == KING) {
+			kpkey ^= bb::zob(us, KING, fsq) ^ bb::zob(us, KING, tsq);
+			crights &= ~((OO | OOO) << (2 * us));
+
+			if (m.flag() == move::CASTLING) {
+				// rook jump
+				if (tsq == fsq + 2)			// OO
+					key ^= bb::zob(us, ROOK, us ? H8 : H1) ^ bb::zob(us, ROOK, us ? F8 : F1);
+				else if (tsq == fsq - 2)	// OOO
+					key ^= bb::zob(us, ROOK, us ? A8 : A1) ^ bb::zob(us, ROOK, us ? D8 : D1);
+			}
+		}
+	}
+
+	return key
+		^ (epsq == NO_SQUARE ? 0 : bb::zob_ep(epsq))
+		^ bb::zob_castle(crights);
+}
+
 void Board::set_root()
 {
 	sp0 = sp;
@@ -675,7 +978,7 @@ void Board::set_root()
 
 bool Board::is_check() const
 {
-	return st().checkers;
+	return get_checkers();
 }
 
 }	// namespace board
@@ -14,8 +14,10 @@
 */
 #pragma once
 #include <string>
+#include <vector>
 #include "bitboard.h"
 #include "move.h"
+#include "nnue.h"
 
 namespace board {
 
@@ -25,16 +27,15 @@ enum {
 	OOO = 2		// Queen side castle (OOO = chess notation)
 };
 
+/* State that play() updates incrementally, and undo() restores by popping the stack. Everything that
+ * can be calculated from the position is in DerivedInfo instead. */
 struct UndoInfo {
 	Key key, kpkey, mat_key;	// zobrist key, king+pawn key, material key
-	Bitboard pinned, dcheckers;	// pinned and discovery checkers for turn
-	Bitboard attacked;			// squares attacked by opp_color(turn)
-	Bitboard checkers;			// pieces checking turn's King
 	Bitboard occ;				// occupancy
-	Bitboard attacks[NB_COLOR][NB_PIECE + 1];
 	Eval psq[NB_COLOR];			// PSQ Eval by color
 
 	int capture;				// piece just captured
+	int moved;					// piece that played last_move (before promotion)
 	int epsq;					// en passant square
 	int crights;				// castling rights, 4 bits in FEN order KQkq
 	int rule50;					// counter for the 50 move rule
@@ -46,8 +47,29 @@ struct UndoInfo {
 	}
 };
 
+/* Calculated on first access, and cached for the ply. The attacks are needed by almost every node
+ * (is_check(), eval), but the pins only when generating moves: not in nodes cut by the TT, or by stand
+ * pat. The NNUE accumulator of the ply is stored separately (it is much bigger), but its validity is
+ * tracked here. */
+struct DerivedInfo {
+	enum { PINS = 1, ATTACKS = 2, ACCUMULATOR = 4 };
+	int valid;					// which of the above are calculated
+	int ply;					// index in game_stack of the ply it belongs to
+
+	// PINS
+	Bitboard pinned, dcheckers;	// pinned and discovery checkers for turn
+
+	// ATTACKS
+	Bitboard attacks[NB_COLOR][NB_PIECE + 1];
+	Bitboard checkers;			// pieces checking turn's King
+};
+
 class Board {
 public:
+	Board(): initialized(false) {}
+	Board(const Board& other) { *this = other; }
+	Board& operator= (const Board& other);
+
 	const UndoInfo& st() const;
 
 	int get_turn() const;
@@ -60,6 +82,12 @@ public:
 	Bitboard get_pieces(int color, int piece) const;
 
 	Bitboard get_attacks(int color, int piece) const;
+	Bitboard get_attacked() const;	// squares attacked by opp_color(turn)
+	Bitboard get_checkers() const;	// pieces checking turn's King
+	Bitboard get_pinned() const;	// pinned pieces of turn
+	Bitboard get_dcheckers() const;	// discovery checkers of turn
+
+	const nnue::Accumulator& get_accumulator() const;	// only when a network is loaded
 
 	Bitboard get_P() const;	
 	Bitboard get_N() const;
@@ -73,6 +101,9 @@ public:
 
 	void set_fen(const std::string& fen);
 	std::string get_fen() const;
+	// same as set_fen(), from the color and piece on each square (NO_PIECE if empty)
+	void set_pos(const int colors[NB_SQUARE], const int pieces[NB_SQUARE], int _turn, int crights,
+		int epsq, int rule50);
 
 	void play(move::move_t m);
 	void undo();
@@ -84,6 +115,7 @@ public:
 
 	Key get_key() const;	// full zobrist key of the position (including ep and crights)
 	Key get_dm_key() const;	// hash key of the last two moves
+	Key key_after(move::move_t m, Key& kpkey) const;	// get_key() and kpkey after m (for prefetching)
 
 private:
 	Bitboard b[NB_PIECE];		// b[piece]: squares occupied by pieces of type piece (both colors)
@@ -93,6 +125,18 @@ private:
 	UndoInfo game_stack[0x400];	// undo stack: use fixed size C-array for speed
 	UndoInfo *sp;				// pointer to the stack top
 	UndoInfo *sp0;				// see set_unwind() and unwind()
+	/* The derived state is only needed along the search path, not for the whole game: it is a ring
+	 * buffer, indexed by ply modulo DerivedSize. An entry whose ply does not match was overwritten by
+	 * a deeper ply. */
+	static const int DerivedSize = 256;	// more than MAX_PLY
+	static_assert(DerivedSize > MAX_PLY + 8 && !(DerivedSize & (DerivedSize - 1)), "DerivedSize");
+	mutable DerivedInfo derived[DerivedSize];
+	DerivedInfo *dp;			// derived state of sp
+	mutable std::vector<nnue::Accumulator> accumulators;	// allocated on first use, like derived
+
+	DerivedInfo *derived_at(int ply) const {
+		return &derived[ply & (DerivedSize - 1)];
+	}
 
 	int turn;
 	int king_pos[NB_COLOR];
@@ -103,12 +147,24 @@ private:
 	void set_square(int color, int piece, int sq, bool calc = true);
 	void clear_square(int color, int piece, int sq, bool calc = true);
 
-	Bitboard calc_attacks(int color) const;
+	// inline fast path: the derived state is read many times per node (eg. pins in movegen)
+	const DerivedInfo& get_derived(int what) const {
+		if ((dp->valid & what) != what)
+			calc_derived(what & ~dp->valid);
+		return *dp;
+	}
+	void calc_derived(int what) const;
+
+	Bitboard calc_attacks(int color, int piece) const;
+	void update_attacks(Bitboard *a, int color, int touched, Bitboard changed) const;
 	Bitboard calc_checkers(int kcolor) const;
 	Bitboard hidden_checkers(bool find_pins, int color) const;
+	void calc_accumulator() const;
 
 	bool verify_keys() const;
+	bool verify_attacks() const;
 	bool verify_psq() const;
+	bool verify_accumulator() const;
 };
 
 extern const std::string PieceLabel[NB_COLOR];
@@ -0,0 +1,218 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * Credits:
+ * - The book format and its keys are those of Polyglot, by Fabien Letouzey.
+*/
+#include <chrono>
+#include <cstdio>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "book.h"
+#include "board.h"
+#include "movegen.h"
+#include "prng.h"
+
+namespace {
+
+const size_t EntrySize = 16;
+
+const uint8_t *data = nullptr;	// entries of the book (nullptr if none)
+size_t count = 0;
+
+#ifndef _WIN32
+void *mapping = nullptr;
+size_t mapping_size = 0;
+#else
+std::vector<uint8_t> buffer;
+#endif
+
+PRNG prng;
+
+uint64_t read_be(const uint8_t *p, int bytes)
+{
+	uint64_t v = 0;
+	for (int i = 0; i < bytes; ++i)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+Key entry_key(size_t i)		{ return read_be(data + i * EntrySize, 8); }
+int entry_move(size_t i)	{ return read_be(data + i * EntrySize + 8, 2); }
+int entry_weight(size_t i)	{ return read_be(data + i * EntrySize + 10, 2); }
+
+move::move_t to_move(const board::Board& B, int pg_move)
+/* Polyglot moves are encoded as: to file (bits 0..2), to row (3..5), from file (6..8), from row
+ * (9..11), promotion (12..14: none, knight, ..., queen). Castling is encoded as king takes rook.
+ * The move is looked up among the legal moves, which also filters out key collisions. */
+{
+	const int fsq = (pg_move >> 6) & 63, prom = (pg_move >> 12) & 7;
+	int tsq = pg_move & 63;
+
+	const int us = B.get_turn();
+	if (B.get_piece_on(fsq) == KING && B.get_piece_on(tsq) == ROOK && B.get_color_on(tsq) == us)
+		tsq = tsq > fsq ? fsq + 2 : fsq - 2;
+
+	move::move_t mlist[MAX_MOVES];
+	move::move_t *end = movegen::gen_moves(B, mlist);
+	for (move::move_t *m = mlist; m != end; ++m)
+		if (m->fsq() == fsq && m->tsq() == tsq
+			&& (m->flag() == move::PROMOTION ? m->prom() == prom - 1 + KNIGHT : !prom))
+			return *m;
+
+	return move::move_t(0);
+}
+
+}	// namespace
+
+namespace book {
+
+bool open(const std::string& file_name)
+{
+	close();
+
+#ifndef _WIN32
+	const int fd = ::open(file_name.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) || !st.st_size || st.st_size % EntrySize) {
+		::close(fd);
+		return false;
+	}
+
+	// shared and read-only: all the engines using this book read the same physical pages
+	void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (m == MAP_FAILED)
+		return false;
+	madvise(m, st.st_size, MADV_RANDOM);
+
+	mapping = m;
+	mapping_size = st.st_size;
+	data = (const uint8_t *)m;
+	count = st.st_size / EntrySize;
+#else
+	FILE *f = fopen(file_name.c_str(), "rb");
+	if (!f)
+		return false;
+
+	fseek(f, 0, SEEK_END);
+	const long size = ftell(f);
+	buffer.resize(size > 0 && size % EntrySize == 0 ? size : 0);
+	const bool ok = !buffer.empty() && !fseek(f, 0, SEEK_SET)
+		&& fread(buffer.data(), 1, buffer.size(), f) == buffer.size();
+	fclose(f);
+	if (!ok) {
+		buffer.clear();
+		return false;
+	}
+
+	data = buffer.data();
+	count = buffer.size() / EntrySize;
+#endif
+
+	prng.init(std::chrono::steady_clock::now().time_since_epoch().count());
+	return true;
+}
+
+void close()
+{
+#ifndef _WIN32
+	if (mapping)
+		munmap(mapping, mapping_size);
+	mapping = nullptr;
+	mapping_size = 0;
+#else
+	buffer.clear();
+#endif
+	data = nullptr;
+	count = 0;
+}
+
+bool enabled()
+{
+	return data;
+}
+
+Key key(const board::Board& B)
+{
+	Key k = 0;
+
+	for (int color = WHITE; color <= BLACK; ++color)
+		for (int piece = PAWN; piece <= KING; ++piece)
+			for (Bitboard b = B.get_pieces(color, piece); b; b &= b - 1)
+				k ^= bb::pg_zob(color, piece, bb::lsb(b));
+
+	k ^= bb::pg_zob_castle(B.st().crights);
+
+	// the en passant file only counts if a pawn can actually capture
+	const int us = B.get_turn(), epsq = B.st().epsq;
+	if (epsq != NO_SQUARE && (bb::pattacks(opp_color(us), epsq) & B.get_pieces(us, PAWN)))
+		k ^= bb::pg_zob_ep(file(epsq));
+
+	return us == WHITE ? k ^ bb::pg_zob_turn() : k;
+}
+
+std::vector<Entry> probe(const board::Board& B)
+{
+	std::vector<Entry> result;
+	if (!data)
+		return result;
+
+	// first entry with a key >= k
+	const Key k = key(B);
+	size_t lo = 0, hi = count;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (entry_key(mid) < k)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (size_t i = lo; i < count && entry_key(i) == k; ++i) {
+		const move::move_t m = to_move(B, entry_move(i));
+		if (m)
+			result.push_back({m, entry_weight(i)});
+	}
+
+	return result;
+}
+
+move::move_t pick(const board::Board& B)
+{
+	const std::vector<Entry> entries = probe(B);
+
+	int total = 0;
+	for (const Entry& e : entries)
+		total += e.weight;
+
+	if (!total)
+		return move::move_t(0);
+
+	int r = prng.rand() % total;
+	for (const Entry& e : entries)
+		if ((r -= e.weight) < 0)
+			return e.move;
+
+	return move::move_t(0);	// unreachable
+}
+
+}	// namespace book
@@ -0,0 +1,39 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include "move.h"
+
+/* Polyglot opening book. The file is a sorted array of 16-byte entries (big endian): key (uint64),
+ * move (uint16), weight (uint16), learn (uint32). It is mapped read-only, so that several engine
+ * processes using the same book share it through the page cache. */
+namespace book {
+
+struct Entry {
+	move::move_t move;
+	int weight;
+};
+
+extern bool open(const std::string& file_name);
+extern void close();
+extern bool enabled();	// a book is open
+
+extern Key key(const board::Board& B);	// Polyglot key of the position
+
+extern std::vector<Entry> probe(const board::Board& B);	// legal book moves of B
+extern move::move_t pick(const board::Board& B);	// random book move, by weight (0 if none)
+
+}	// namespace book
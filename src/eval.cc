@@ -15,7 +15,8 @@
  * Credits:
  * - Passed pawn scoring is inspired by Stockfish, by Marco Costalba.
 */
-#include <cstring>
+#include <fstream>
+#include <sstream>
 #include "eval.h"
 #include "kpk.h"
 #include "psq.h"
@@ -28,29 +29,6 @@ int KingDistanceToSafety[NB_COLOR][NB_SQUARE];
 // Minimum taxi distance for to the corner of the given color. Used for KBNK mating technique.
 int KingTaxiDistanceToCorner[NB_COLOR][NB_SQUARE];
 
-class PawnCache {
-public:
-	struct Entry {
-		Key key;
-		Eval eval_white;
-		Bitboard passers;
-	};
-
-	PawnCache() {
-		std::memset(buf, 0, sizeof(buf));
-	}
-
-	Entry *probe(Key key) {
-		return &buf[key & (count - 1)];
-	}
-
-private:
-	static const int count = 0x10000;
-	Entry buf[count];
-};
-
-PawnCache PC;
-
 // Known draws (with recognizer function)
 static const Key KPK  = 0x110000000001ULL;
 static const Key KKP  = 0x110000000010ULL;
@@ -61,10 +39,29 @@ static const Key KKBP = 0x110000100010ULL;
 static const Key KBNK = 0x110000010100ULL;
 static const Key KKBN = 0x110000101000ULL;
 
+// Tunable parameters: see eval::params()
+int MobUnit[NB_PHASE][NB_PIECE] = {
+	{0, 4, 5, 2, 1, 0},		// Opening
+	{0, 4, 5, 4, 2, 0}		// EndGame
+};
+int AttackWeight[NB_PIECE] = {0, 3, 3, 4, 0, 0};
+int ShieldPenalty[8] = {55, 0, 15, 40, 50, 55, 55, 0};	// CLOP
+int StormPenalty[8] = {5, 0, 30, 10, 5, 0, 0, 0};	// tuned
+int PasserOpening = 6, PasserEndgame = 3;
+int Isolated = 20;
+Eval Hole = {16, 10};
+int RookOpen = 8, RookTrapped = 40;
+Eval Hanging = {10, 18};
+Eval BishopPair = {51, 57};	// CLOP
+int ScaleNoPawns = 8, ScaleNoMating = 4, ScaleOppositeBishops = 12;	// CLOP (in 16th)
+
+std::vector<int> DefaultParams;	// in params() order, saved by init()
+
 class EvalInfo {
 public:
-	explicit EvalInfo(const board::Board *_B): B(_B) {
+	EvalInfo(const board::Board *_B, eval::PawnCache *_PC, eval::MaterialCache *_MC): B(_B), PC(_PC) {
 		e[WHITE] = e[BLACK] = {0, 0};
+		me = probe_material(_MC);
 	}
 
 	void select_side(int color);
@@ -73,11 +70,13 @@ public:
 	void eval_safety();
 	void eval_pieces();
 	void eval_pawns();
-	void adjust_kbnk();
+	bool eval_endgame();
 	int interpolate();
 
 private:
 	const board::Board *B;
+	eval::PawnCache *PC;
+	const eval::MaterialCache::Entry *me;
 	Eval e[NB_COLOR];
 	int us, them, our_ksq, their_ksq;
 	Bitboard our_pawns, their_pawns;
@@ -91,6 +90,7 @@ private:
 	void eval_passer(int sq, Eval* res);
 	void eval_passer_interaction(int sq);
 
+	const eval::MaterialCache::Entry *probe_material(eval::MaterialCache *MC) const;
 	int calc_phase() const;
 	Eval eval_white() const {
 		Eval tmp(e[WHITE]);
@@ -110,12 +110,9 @@ void EvalInfo::select_side(int color)
 
 void EvalInfo::eval_material()
 {
-	// Material (including PSQ bonus)
+	// Material (including PSQ bonus), and bishop pair
 	e[us] += B->st().psq[us];
-
-	// Bishop pair
-	if (bb::several_bits(B->get_pieces(us, BISHOP)))
-		e[us] += {51, 57};	// CLOP
+	e[us] += me->bishop_pair[us];
 }
 
 void EvalInfo::score_mobility(int p0, int p, Bitboard tss)
@@ -126,14 +123,10 @@ void EvalInfo::score_mobility(int p0, int p, Bitboard tss)
 		{ -4, -3, -2, -1, 0, 1, 2, 3, 4, 5, 5, 6, 6, 7},
 		{ -5, -4, -3, -2, -1, 0, 1, 2, 3, 4, 5, 6, 6, 7, 7}
 	};
-	static const int mob_unit[NB_PHASE][NB_PIECE] = {
-		{0, 4, 5, 2, 1, 0},		// Opening
-		{0, 4, 5, 4, 2, 0}		// EndGame
-	};
 
 	const int count = mob_count[p0][bb::count_bit(tss)];
-	e[us].op += count * mob_unit[OPENING][p];
-	e[us].eg += count * mob_unit[ENDGAME][p];
+	e[us].op += count * MobUnit[OPENING][p];
+	e[us].eg += count * MobUnit[ENDGAME][p];
 }
 
 void EvalInfo::eval_mobility()
@@ -175,8 +168,6 @@ void EvalInfo::eval_mobility()
 void EvalInfo::score_attacks(int p0, int sq, Bitboard sq_attackers, Bitboard defended,
 							 int *total_count, int *total_weight)
 {
-	static const int AttackWeight[NB_PIECE] = {0, 3, 3, 4, 0, 0};
-
 	if (sq_attackers) {
 		int count = bb::count_bit(sq_attackers);
 		*total_weight += AttackWeight[p0] * count;
@@ -291,7 +282,7 @@ void EvalInfo::eval_passer_interaction(int sq)
 void EvalInfo::eval_pawns()
 {
 	const Key key = B->st().kpkey;
-	PawnCache::Entry *h = PC.probe(key);
+	eval::PawnCache::Entry *h = PC->probe(key);
 
 	if (h->key == key)
 		e[WHITE] += h->eval_white;
@@ -317,9 +308,6 @@ void EvalInfo::eval_pawns()
 
 void EvalInfo::eval_shield_storm()
 {
-	static const int ShieldPenalty[8] = {55, 0, 15, 40, 50, 55, 55, 0};	// CLOP
-	static const int StormPenalty[8] = {5, 0, 30, 10, 5, 0, 0, 0};	// tuned
-
 	const int kf = file(our_ksq);
 
 	for (int f = kf - 1; f <= kf + 1; ++f) {
@@ -359,8 +347,8 @@ void EvalInfo::eval_passer(int sq, Eval *res)
 	const int Q = L * (L - 1);						// Quadratic part	0..20
 
 	// score based on rank
-	res->op += 6 * Q;
-	res->eg += 3 * (Q + L + 1);
+	res->op += PasserOpening * Q;
+	res->eg += PasserEndgame * (Q + L + 1);
 
 	if (Q) {
 		// adjustment for king distance
@@ -373,8 +361,6 @@ void EvalInfo::eval_passer(int sq, Eval *res)
 
 Bitboard EvalInfo::do_eval_pawns()
 {
-	static const int Isolated = 20;
-	static const Eval Hole = {16, 10};
 	Bitboard passers = 0;
 
 	eval_shield_storm();
@@ -423,7 +409,6 @@ Bitboard EvalInfo::do_eval_pawns()
 
 void EvalInfo::eval_pieces()
 {
-	static const int RookOpen = 8, RookTrapped = 40;
 	const bool can_castle = B->st().crights & (3 << (2 * us));
 	Bitboard fss;
 
@@ -461,12 +446,13 @@ void EvalInfo::eval_pieces()
 	Bitboard hanging = (loose_pawns | loose_pieces) & B->get_attacks(them, NO_PIECE);
 	while (hanging) {
 		const int victim = B->get_piece_on(bb::pop_lsb(&hanging));
-		e[us].op -= 10 + psq::material(victim).op / 64;
-		e[us].eg -= 18 + psq::material(victim).eg / 64;
+		e[us].op -= Hanging.op + psq::material(victim).op / 64;
+		e[us].eg -= Hanging.eg + psq::material(victim).eg / 64;
 	}
 }
 
 int EvalInfo::calc_phase() const
+// Not in the material cache: piece_psq includes the PSQ bonus of pieces, not only their material
 {
 	static const int total = 4 * (vN + vB + vR) + 2 * vQ;
 	return (B->st().piece_psq[WHITE] + B->st().piece_psq[BLACK]) * 1024 / total;
@@ -476,32 +462,17 @@ int EvalInfo::interpolate()
 {
 	us = B->get_turn(), them = opp_color(us);
 	const int strong_side = e[BLACK].eg > e[WHITE].eg;
-	int eval_factor = 16;
-
-	// Strongest side has no pawns
-	if (!B->get_pieces(strong_side, PAWN)) {
-		if (board::has_mating_material(*B, strong_side)) {
-			// Half the endgame eval, unless we're in a KXK situation where X is mating material
-			if (bb::several_bits(B->get_pieces(opp_color(strong_side))))
-				eval_factor = 8;	// CLOP
-		} else
-			// No mating material: divide endgame eval by 4
-			eval_factor = 4;		// CLOP
-	}
+	int eval_factor = me->eval_factor[strong_side];
 
 	// Opposite color bishop
-	if (eval_factor == 16 && (B->st().mat_key & 0xFF0000ULL) == 0x110000ULL) {
+	if (eval_factor == 16 && me->opposite_bishops) {
 		// Each side has exactly one bishop: are the two bishops on opposite color squares?
 		const Bitboard b = B->get_B();
 		if ((b & bb::WhiteSquares) && (b & bb::BlackSquares))
-			eval_factor = 12;		// CLOP
+			eval_factor = ScaleOppositeBishops;
 	}
 
-	// Basic material imbalance, based on counting minor pieces
-	const int om = bb::count_bit(B->get_NB(us));
-	const int tm = bb::count_bit(B->get_NB(them));
-	const int imbalance = 2 * (om - tm) * bb::count_bit(B->get_P());
-	
+	const int imbalance = us == WHITE ? me->imbalance : -me->imbalance;
 	const int phase = calc_phase();
 	const int op = e[us].op - e[them].op, eg = e[us].eg - e[them].eg;
 	const int eval = (phase * op + (1024 - phase) * eg * eval_factor / 16) / 1024;
@@ -509,17 +480,9 @@ int EvalInfo::interpolate()
 	return eval + imbalance;
 }
 
-void EvalInfo::adjust_kbnk()
+bool EvalInfo::eval_endgame()
 {
-	assert(B->st().mat_key == KBNK || B->st().mat_key == KKBN);
-	const int strong_side = B->st().mat_key == KBNK ? WHITE : BLACK;
-	const int weak_side = opp_color(strong_side);
-
-	const int weak_ksq = B->get_king_pos(weak_side);
-	const int bcolor = (B->get_pieces(strong_side, BISHOP) & bb::WhiteSquares) ? WHITE : BLACK;
-
-	// Minimum taxi distance to a mate corner, is a bonus for the defending King (further is better)
-	e[weak_side].eg += 32 * (KingTaxiDistanceToCorner[bcolor][weak_ksq] - 4);
+	return me->endgame && me->endgame(*B, e);
 }
 
 bool kpk_draw(const board::Board& B)
@@ -558,6 +521,75 @@ bool kbpk_draw(const board::Board& B)
 		&& bb::kdist(their_king, prom_sq) - (stm != us) <= bb::kdist(pawn, prom_sq);
 }
 
+bool kpk_endgame(const board::Board& B, Eval *)
+{
+	return kpk_draw(B);
+}
+
+bool kbpk_endgame(const board::Board& B, Eval *)
+{
+	return kbpk_draw(B);
+}
+
+bool kbnk_endgame(const board::Board& B, Eval *e)
+// Mating technique: the defending King must go to a corner of the bishop's color
+{
+	const int strong_side = B.st().mat_key == KBNK ? WHITE : BLACK;
+	const int weak_side = opp_color(strong_side);
+
+	const int weak_ksq = B.get_king_pos(weak_side);
+	const int bcolor = (B.get_pieces(strong_side, BISHOP) & bb::WhiteSquares) ? WHITE : BLACK;
+
+	// Minimum taxi distance to a mate corner, is a bonus for the defending King (further is better)
+	e[weak_side].eg += 32 * (KingTaxiDistanceToCorner[bcolor][weak_ksq] - 4);
+	return false;
+}
+
+const eval::MaterialCache::Entry *EvalInfo::probe_material(eval::MaterialCache *MC) const
+/* All the terms of the entry must only depend on the material, so that they can be computed from
+ * any position with the same mat_key */
+{
+	const Key mk = B->st().mat_key;
+	eval::MaterialCache::Entry *h = MC->probe(mk);
+	if (h->key == mk)
+		return h;
+
+	h->key = mk;
+
+	// Basic material imbalance, based on counting minor pieces
+	const int wm = bb::count_bit(B->get_NB(WHITE)), bm = bb::count_bit(B->get_NB(BLACK));
+	h->imbalance = 2 * (wm - bm) * bb::count_bit(B->get_P());
+
+	for (int color = WHITE; color <= BLACK; ++color) {
+		if (bb::several_bits(B->get_pieces(color, BISHOP)))
+			h->bishop_pair[color] = BishopPair;
+		else
+			h->bishop_pair[color] = {0, 0};
+
+		// Endgame scaling, when color is the strong side and has no pawns
+		h->eval_factor[color] = 16;
+		if (!B->get_pieces(color, PAWN)) {
+			if (board::has_mating_material(*B, color)) {
+				// Half the endgame eval, unless we're in a KXK situation where X is mating material
+				if (bb::several_bits(B->get_pieces(opp_color(color))))
+					h->eval_factor[color] = ScaleNoPawns;
+			} else
+				// No mating material: divide endgame eval by 4
+				h->eval_factor[color] = ScaleNoMating;
+		}
+	}
+
+	h->opposite_bishops = (mk & 0xFF0000ULL) == 0x110000ULL;
+
+	// Recognize some specific endgames
+	h->endgame = mk == KPK || mk == KKP ? kpk_endgame
+		: mk == KBPK || mk == KKBP ? kbpk_endgame
+		: mk == KBNK || mk == KKBN ? kbnk_endgame
+		: nullptr;
+
+	return h;
+}
+
 int stand_pat_penalty(const board::Board& B, Bitboard hanging)
 {
 	if (bb::several_bits(hanging)) {
@@ -569,7 +601,7 @@ int stand_pat_penalty(const board::Board& B, Bitboard hanging)
 			piece = std::min(piece, p);
 		}
 		return psq::material(piece).op / 2;
-	} else if (hanging & B.st().pinned) {
+	} else if (hanging & B.get_pinned()) {
 		// Only one piece hanging, but also pinned. Return half its value.
 		assert(bb::count_bit(hanging) == 1);
 		const int sq = bb::lsb(hanging), piece = B.get_piece_on(sq);
@@ -601,22 +633,110 @@ void init()
 				? std::min(taxi_dist_to_A1, taxi_dist_to_H8)
 				: std::min(taxi_dist_to_A8, taxi_dist_to_H1);
 		}
+
+	for (auto& p : params())
+		DefaultParams.push_back(*p.value);
 }
 
-int symmetric_eval(const board::Board& B)
+std::vector<Param> params()
 {
-	assert(!B.is_check());
-	EvalInfo ei(&B);
-
-	if (bb::count_bit(B.st().occ) <= 4) {
-		// Recognize some specific endgames
-		const Bitboard mk = B.st().mat_key;
-		if (is_tb_draw(B))
-			return 0;
-		else if (mk == KBNK || mk == KKBN)
-			ei.adjust_kbnk();
+	std::vector<Param> p;
+	psq::params(p);
+
+	const std::string piece = "PNBRQK";
+	for (int pc = KNIGHT; pc <= QUEEN; ++pc) {
+		p.push_back({"MobUnitOpening" + piece.substr(pc, 1), &MobUnit[OPENING][pc], 0, 20});
+		p.push_back({"MobUnitEndgame" + piece.substr(pc, 1), &MobUnit[ENDGAME][pc], 0, 20});
+	}
+	for (int pc = KNIGHT; pc <= ROOK; ++pc)
+		p.push_back({"AttackWeight" + piece.substr(pc, 1), &AttackWeight[pc], 0, 20});
+
+	// rank 1 (no pawn, or semi-open file), and ranks 3 to 7 (rank 2 is the reference)
+	for (int r = RANK_1; r <= RANK_7; ++r)
+		if (r != RANK_2) {
+			p.push_back({"ShieldPenalty" + std::to_string(r + 1), &ShieldPenalty[r], 0, 200});
+			p.push_back({"StormPenalty" + std::to_string(r + 1), &StormPenalty[r], 0, 200});
+		}
+
+	p.insert(p.end(), {
+		{"PasserOpening", &PasserOpening, 0, 20}, {"PasserEndgame", &PasserEndgame, 0, 20},
+		{"Isolated", &Isolated, 0, 100}, {"HoleOpening", &Hole.op, 0, 100},
+		{"HoleEndgame", &Hole.eg, 0, 100}, {"RookOpen", &RookOpen, 0, 100},
+		{"RookTrapped", &RookTrapped, 0, 200}, {"HangingOpening", &Hanging.op, 0, 100},
+		{"HangingEndgame", &Hanging.eg, 0, 100}, {"BishopPairOpening", &BishopPair.op, 0, 200},
+		{"BishopPairEndgame", &BishopPair.eg, 0, 200}, {"ScaleNoPawns", &ScaleNoPawns, 0, 16},
+		{"ScaleNoMating", &ScaleNoMating, 0, 16}, {"ScaleOppositeBishops", &ScaleOppositeBishops, 0, 16}
+	});
+
+	return p;
+}
+
+bool set_param(const std::string& name, int value)
+{
+	for (auto& p : params())
+		if (p.name == name) {
+			*p.value = std::max(p.min, std::min(p.max, value));
+			psq::init();
+			return true;
+		}
+
+	return false;
+}
+
+bool load_params(const std::string& file_name)
+{
+	std::ifstream f(file_name);
+	std::string line, name;
+	int value;
+
+	if (!f.is_open())
+		return false;
+
+	// Read the whole file first, so that a bad line leaves the current values unchanged
+	const std::vector<Param> p = params();
+	std::vector<std::pair<int *, int>> values;
+	while (getline(f, line)) {
+		std::istringstream is(line);
+		if (!(is >> name) || name[0] == '#')
+			continue;
+
+		auto it = std::find_if(p.begin(), p.end(), [&](const Param& q) { return q.name == name; });
+		if (it == p.end() || !(is >> value))
+			return false;
+		values.push_back({it->value, std::max(it->min, std::min(it->max, value))});
 	}
 
+	for (auto& v : values)
+		*v.first = v.second;
+	psq::init();
+	return true;
+}
+
+void reset_params()
+{
+	const std::vector<Param> p = params();
+	assert(p.size() == DefaultParams.size());
+
+	for (size_t i = 0; i < p.size(); ++i)
+		*p[i].value = DefaultParams[i];
+	psq::init();
+}
+
+void save_params(std::ostream& os)
+{
+	for (auto& p : params())
+		os << p.name << ' ' << *p.value << '\n';
+}
+
+int symmetric_eval(const board::Board& B, PawnCache& PC, MaterialCache& MC)
+{
+	assert(!B.is_check());
+	EvalInfo ei(&B, &PC, &MC);
+
+	// Specific endgames
+	if (ei.eval_endgame())
+		return 0;
+
 	ei.eval_pawns();
 	for (int color = WHITE; color <= BLACK; ++color) {
 		ei.select_side(color);
@@ -13,13 +13,150 @@
  * see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
 #include "board.h"
 
 namespace eval {
 
+// Hit statistics of a cache
+struct CacheStats {
+	CacheStats(): probes(0), hits(0) {}
+	uint64_t probes, hits;
+
+	double hit_rate() const { return probes ? 100.0 * hits / probes : 0.0; }	// in %
+	CacheStats& operator+= (const CacheStats& s) { probes += s.probes; hits += s.hits; return *this; }
+};
+
+/* Pawn Cache: caches the eval of pawn structure (including the pawn shield and storm of each king),
+ * which only depends on the position of kings and pawns, indexed by kpkey. Each search thread owns
+ * its own instance, as entries are not written atomically. */
+class PawnCache {
+public:
+	struct Entry {
+		Key key;
+		Eval eval_white;
+		Bitboard passers;
+	};
+
+	explicit PawnCache(size_t kb = 2048) { resize(kb); }
+
+	void resize(size_t kb) {	// rounded down to a power of two number of entries
+		const size_t n = std::max<size_t>((kb << 10) / sizeof(Entry), 1);
+		table.assign(1ULL << bb::msb(n), Entry());
+		size_kb = kb;
+	}
+	size_t size() const { return size_kb; }
+	void clear() { std::fill(table.begin(), table.end(), Entry()); }
+
+	Entry *probe(Key key) {
+		Entry *e = &table[key & (table.size() - 1)];
+		++stats.probes;
+		stats.hits += e->key == key;
+		return e;
+	}
+	void prefetch(Key key) const {
+		__builtin_prefetch((char *)&table[key & (table.size() - 1)]);
+	}
+
+	CacheStats stats;
+
+private:
+	std::vector<Entry> table;
+	size_t size_kb;
+};
+
+/* Material Cache: caches what only depends on the material signature (mat_key): minor piece
+ * imbalance, bishop pair, endgame scaling and specialized endgame function. Indexed by a
+ * multiplicative hash of mat_key, which is unique (piece counts). Each search thread owns its own
+ * instance. */
+class MaterialCache {
+public:
+	// Specialized endgame: returns true for a known draw, otherwise adjusts the eval e[]
+	typedef bool (*Endgame)(const board::Board& B, Eval e[NB_COLOR]);
+
+	struct Entry {
+		Key key;
+		Eval bishop_pair[NB_COLOR];
+		int imbalance;	// minor piece imbalance, for White
+		uint8_t eval_factor[NB_COLOR];	// endgame scaling (in 16th), if this color is the strong side
+		bool opposite_bishops;	// one bishop each (are they on opposite colors ?)
+		Endgame endgame;	// nullptr if none
+	};
+
+	MaterialCache() {
+		clear();
+	}
+	void clear() { std::memset(buf, 0, sizeof(buf)); }
+
+	Entry *probe(Key key) {
+		return &buf[(key * 0x9E3779B97F4A7C15ULL) >> (64 - bits)];
+	}
+
+private:
+	static const int bits = 12, count = 1 << bits;
+	Entry buf[count];
+};
+
+/* Eval Cache: caches symmetric_eval(), indexed by the full zobrist key. An entry packs the upper 48
+ * bits of the key with the 16-bit eval, so that it is a single word. Like the PawnCache, each search
+ * thread owns its own instance. */
+class EvalCache {
+public:
+	EvalCache(): size_kb(0) {}
+
+	void resize(size_t kb) {	// rounded down to a power of two number of entries
+		const size_t n = (kb << 10) / sizeof(uint64_t);
+		table.assign(n ? 1ULL << bb::msb(n) : 0, 0);
+		size_kb = kb;
+	}
+	size_t size() const { return size_kb; }
+	void clear() { std::fill(table.begin(), table.end(), 0); }
+
+	bool probe(Key key, int& eval) {
+		if (table.empty())
+			return false;
+		++stats.probes;
+		const uint64_t e = table[key & (table.size() - 1)];
+		if ((e ^ key) >> 16)
+			return false;
+		++stats.hits;
+		eval = (int16_t)e;
+		return true;
+	}
+	void prefetch(Key key) const {
+		if (!table.empty())
+			__builtin_prefetch((char *)&table[key & (table.size() - 1)]);
+	}
+
+	void store(Key key, int eval) {
+		if (!table.empty()) {
+			assert(std::abs(eval) <= 0x7fff);
+			table[key & (table.size() - 1)] = (key & ~0xffffULL) | (uint16_t)eval;
+		}
+	}
+
+	CacheStats stats;
+
+private:
+	std::vector<uint64_t> table;
+	size_t size_kb;
+};
+
 extern void init();
 
-extern int symmetric_eval(const board::Board& B);
+/* Eval parameters (including PSQ parameters), for tuning. After changing a value directly,
+ * psq::init() must be called, and cached evals are stale. Parameter files have one "name value" line
+ * per parameter (missing ones are unchanged). */
+extern std::vector<Param> params();
+extern bool set_param(const std::string& name, int value);	// clamped to the range
+extern bool load_params(const std::string& file_name);	// all or nothing
+extern void reset_params();	// back to the compiled-in values
+extern void save_params(std::ostream& os);
+
+extern int symmetric_eval(const board::Board& B, PawnCache& PC, MaterialCache& MC);
 extern int asymmetric_eval(const board::Board& B, Bitboard hanging_pieces);
 
 extern bool is_tb_draw(const board::Board& B);
@@ -12,7 +12,12 @@
  * You should have received a copy of the GNU General Public License along with this program. If not,
  * see <http://www.gnu.org/licenses/>.
 */
+#include <cstdlib>
 #include "test.h"
+#include "analyse.h"
+#include "perft.h"
+#include "selfplay.h"
+#include "tune.h"
 #include "psq.h"
 #include "eval.h"
 #include "search.h"
@@ -26,13 +31,31 @@ int main (int argc, char **argv)
 	psq::init();
 	eval::init();
 
-	if (argc == 2) {
+	if (argc >= 2) {
 		if (std::string(argv[1]) == "bench")
-			bench(12);
+			bench(12, argc > 2 ? std::atoi(argv[2]) : 1, argc > 3 ? std::atoi(argv[3]) : 32);
 		else if (std::string(argv[1]) == "perft")
-			test_perft();
+			perft_suite(argc, argv);
 		else if (std::string(argv[1]) == "see")
 			test_see();
+		else if (std::string(argv[1]) == "book")
+			test_book();
+		else if (std::string(argv[1]) == "seebench")
+			bench_see();
+		else if (std::string(argv[1]) == "nnuebench")
+			bench_nnue(argc > 2 ? argv[2] : nullptr);
+		else if (std::string(argv[1]) == "microbench")
+			bench_micro(argc > 2 ? std::max(std::atoi(argv[2]), 1) : 10, argc > 3 ? argv[3] : nullptr);
+		else if (std::string(argv[1]) == "stop")
+			bench_stop(argc > 2 ? std::atoi(argv[2]) : 500);
+		else if (std::string(argv[1]) == "analyse")
+			analyse(argc, argv);
+		else if (std::string(argv[1]) == "selfplay")
+			selfplay_games(argc, argv);
+		else if (std::string(argv[1]) == "unpack")
+			unpack_games(argc, argv);
+		else if (std::string(argv[1]) == "tune")
+			tune(argc, argv);
 
 		if (dbg_cnt1 || dbg_cnt2)
 			std::cout << dbg_cnt1 << '\n' << dbg_cnt2 << std::endl;
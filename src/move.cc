@@ -30,6 +30,8 @@ std::string square_to_string(int sq)
 	return s.str();
 }
 
+const int see_val[NB_PIECE + 1] = {vOP, vN, vB, vR, vQ, vK, 0};
+
 }	// namespace
 
 namespace move {
@@ -45,7 +47,7 @@ int is_check(const board::Board& B, move_t m)
 	int kpos = B.get_king_pos(them);
 
 	// test discovered check
-	if ( (bb::test_bit(B.st().dcheckers, fsq))		// discovery checker
+	if ( (bb::test_bit(B.get_dcheckers(), fsq))		// discovery checker
 		 && (!bb::test_bit(bb::direction(kpos, fsq), tsq)))	// move out of its dc-ray
 		return 2;
 	// test direct check
@@ -145,8 +147,6 @@ int see(const board::Board& B, move_t m)
 // Iterative SEE based on Glaurung. Adapted and improved to handle promotions, promoting recaptures
 // and en-passant captures.
 {
-	static const int see_val[NB_PIECE + 1] = {vOP, vN, vB, vR, vQ, vK, 0};
-
 	int fsq = m.fsq(), tsq = m.tsq();
 	int stm = B.get_color_on(fsq);	// side to move
 	uint64_t attackers, stm_attackers;
@@ -173,7 +173,7 @@ int see(const board::Board& B, move_t m)
 		capture = B.get_piece_on(fsq);
 
 	// If the opponent has no attackers we are finished
-	attackers = bb::test_bit(B.st().attacked, tsq) ? calc_attackers(B, tsq, occ) : 0;
+	attackers = bb::test_bit(B.get_attacked(), tsq) ? calc_attackers(B, tsq, occ) : 0;
 	stm = opp_color(stm);
 	stm_attackers = attackers & B.get_pieces(stm);
 	if (!stm_attackers)
@@ -228,6 +228,82 @@ int see(const board::Board& B, move_t m)
 	return swap_list[0];
 }
 
+bool see_ge(const board::Board& B, move_t m, int threshold)
+/* Same as see(B, m) >= threshold, but stops as soon as the answer is known. The swap list of see()
+ * is built in the same order, and negamaxed on the fly with a null window: see() >= t if and only if
+ * swap_list[0] >= t, and the negamax of the rest of the list is <= -t (ie. < 1 - t). So we only track
+ * balance = swap_list[i] - t[i], where t[0] = threshold and t[i+1] = 1 - t[i]. As soon as it goes
+ * negative, or the capture sequence ends, the answer depends only on the parity of i. */
+{
+	int fsq = m.fsq(), tsq = m.tsq();
+	int stm = B.get_color_on(fsq);	// side to move
+	uint64_t attackers, stm_attackers;
+	uint64_t occ = B.st().occ;
+	int piece, capture;
+
+	// Determine captured piece
+	if (m.flag() == EN_PASSANT) {
+		bb::clear_bit(&occ, bb::pawn_push(opp_color(stm), tsq));
+		capture = PAWN;
+	} else
+		capture = B.get_piece_on(tsq);
+	assert(capture != KING);
+
+	int balance = see_val[capture] - threshold;
+	bb::clear_bit(&occ, fsq);
+
+	// Handle promotion
+	if (m.flag() == PROMOTION) {
+		balance += see_val[m.prom()] - see_val[PAWN];
+		capture = QUEEN;
+	} else
+		capture = B.get_piece_on(fsq);
+
+	if (balance < 0)
+		return false;
+
+	/* Even if the opponent recaptures, and we can't recapture back, the threshold is reached: no need
+	 * to look at the attackers. This is the most common case (eg. PxN, or capturing an undefended
+	 * piece). Beware of promoting recaptures. */
+	stm = opp_color(stm);
+	const int promotion = bb::test_bit(bb::eighth_rank(stm), tsq) ? see_val[QUEEN] - see_val[PAWN] : 0;
+	if (-balance - 1 + see_val[capture] + promotion < 0)
+		return true;
+
+	attackers = bb::test_bit(B.get_attacked(), tsq) ? calc_attackers(B, tsq, occ) : 0;
+	bool even = true;	// parity of the last swap list index
+
+	while ( (stm_attackers = attackers & B.get_pieces(stm)) ) {
+		// Locate, and remove the least valuable attacker (see above)
+		for (piece = PAWN; !(stm_attackers & B.get_pieces(stm, piece)); ++piece)
+			assert(piece < KING);
+		bb::clear_bit(&occ, bb::lsb(stm_attackers & B.get_pieces(stm, piece)));
+		attackers |= (B.get_RQ() & bb::rattacks(tsq) & bb::rattacks(tsq, occ))
+					 | (B.get_BQ() & bb::battacks(tsq) & bb::battacks(tsq, occ));
+		attackers &= occ;
+
+		// next entry of the swap list (beware of promoting pawn captures)
+		balance = -balance - 1 + see_val[capture];
+		if (piece == PAWN && bb::test_bit(bb::eighth_rank(stm), tsq)) {
+			balance += see_val[QUEEN] - see_val[PAWN];
+			capture = QUEEN;
+		} else
+			capture = piece;
+
+		if (balance < 0)
+			break;
+
+		even = !even;
+		stm = opp_color(stm);
+
+		// Stop after a king capture: the last entry of the swap list is see_val[KING]
+		if (piece == KING && (attackers & B.get_pieces(stm)))
+			return see_val[KING] >= (even ? 1 - threshold : threshold) ? !even : even;
+	}
+
+	return even;
+}
+
 int mvv_lva(const board::Board& B, move_t m)
 {
 	// Queen is the best capture available (King can't be captured since move is legal)
@@ -65,6 +65,7 @@ extern move_t string_to_move(const board::Board& B, const std::string& s);
 extern std::string move_to_string(move_t m);
 
 extern int see(const board::Board& B, move_t m);
+extern bool see_ge(const board::Board& B, move_t m, int threshold);	// see(B, m) >= threshold
 extern int mvv_lva(const board::Board& B, move_t m);
 
 }	// namespace move
@@ -12,13 +12,15 @@
  * You should have received a copy of the GNU General Public License along with this program. If not,
  * see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
 #include <chrono>
 #include "movegen.h"
 #include "board.h"
 
 namespace {
 
-move::move_t *make_pawn_moves(const board::Board& B, int fsq, int tsq, move::move_t *mlist, bool sub_promotions)
+move::move_t *make_pawn_moves(const board::Board& B, Bitboard pinned, int fsq, int tsq, move::move_t *mlist,
+	bool sub_promotions)
 /* Centralise the pawnm moves generation: given (fsq,tsq) the rest follows. We filter here all the
  * indirect self checks (through fsq, or through the ep captured square) */
 {
@@ -27,7 +29,7 @@ move::move_t *make_pawn_moves(const board::Board& B, int fsq, int tsq, move::mov
 	int kpos = B.get_king_pos(us);
 
 	// filter self check through fsq
-	if (bb::test_bit(B.st().pinned, fsq) && !bb::test_bit(bb::direction(kpos, fsq), tsq))
+	if (bb::test_bit(pinned, fsq) && !bb::test_bit(bb::direction(kpos, fsq), tsq))
 		return mlist;
 
 	move::move_t m;
@@ -64,7 +66,8 @@ move::move_t *make_pawn_moves(const board::Board& B, int fsq, int tsq, move::mov
 	return mlist;
 }
 
-move::move_t *make_piece_moves(const board::Board& B, int fsq, Bitboard tss, move::move_t *mlist)
+move::move_t *make_piece_moves(const board::Board& B, Bitboard pinned, int fsq, Bitboard tss,
+	move::move_t *mlist)
 /* Centralise the generation of a piece move: given (fsq,tsq) the rest follows. We filter indirect
  * self checks here. Note that direct self-checks aren't generated, so we don't check them here. In
  * other words, we never put our King in check before calling this function */
@@ -76,7 +79,7 @@ move::move_t *make_piece_moves(const board::Board& B, int fsq, Bitboard tss, mov
 	m.fsq(fsq);
 	m.flag(move::NORMAL);
 
-	if (bb::test_bit(B.st().pinned, fsq))
+	if (bb::test_bit(pinned, fsq))
 		tss &= bb::direction(kpos, fsq);
 
 	while (tss) {
@@ -98,6 +101,7 @@ move::move_t *gen_piece_moves(const board::Board& B, Bitboard targets, move::mov
 	assert(!king_moves || !B.is_check());	// do not use when in check (use gen_evasion)
 	const int us = B.get_turn();
 	assert(!(targets & B.get_pieces(us)));
+	const Bitboard pinned = B.get_pinned();
 	Bitboard fss;
 
 	// Knight Moves
@@ -105,7 +109,7 @@ move::move_t *gen_piece_moves(const board::Board& B, Bitboard targets, move::mov
 	while (fss) {
 		int fsq = bb::pop_lsb(&fss);
 		Bitboard tss = bb::nattacks(fsq) & targets;
-		mlist = make_piece_moves(B, fsq, tss, mlist);
+		mlist = make_piece_moves(B, pinned, fsq, tss, mlist);
 	}
 
 	// Rook Queen moves
@@ -113,7 +117,7 @@ move::move_t *gen_piece_moves(const board::Board& B, Bitboard targets, move::mov
 	while (fss) {
 		int fsq = bb::pop_lsb(&fss);
 		Bitboard tss = targets & bb::rattacks(fsq, B.st().occ);
-		mlist = make_piece_moves(B, fsq, tss, mlist);
+		mlist = make_piece_moves(B, pinned, fsq, tss, mlist);
 	}
 
 	// Bishop Queen moves
@@ -121,15 +125,15 @@ move::move_t *gen_piece_moves(const board::Board& B, Bitboard targets, move::mov
 	while (fss) {
 		int fsq = bb::pop_lsb(&fss);
 		Bitboard tss = targets & bb::battacks(fsq, B.st().occ);
-		mlist = make_piece_moves(B, fsq, tss, mlist);
+		mlist = make_piece_moves(B, pinned, fsq, tss, mlist);
 	}
 
 	// King moves (king_moves == false is only used for check escapes)
 	if (king_moves) {
 		int fsq = B.get_king_pos(us);
 		// here we also filter direct self checks, which shouldn't be sent to serialize_moves
-		Bitboard tss = bb::kattacks(fsq) & targets & ~B.st().attacked;
-		mlist = make_piece_moves(B, fsq, tss, mlist);
+		Bitboard tss = bb::kattacks(fsq) & targets & ~B.get_attacked();
+		mlist = make_piece_moves(B, pinned, fsq, tss, mlist);
 	}
 
 	return mlist;
@@ -151,7 +155,7 @@ move::move_t *gen_castling(const board::Board& B, move::move_t *mlist)
 		Bitboard safe = 3ULL << (m.fsq() + 1);	// must not be attacked
 		Bitboard empty = safe;					// must be empty
 
-		if (!(B.st().attacked & safe) && !(B.st().occ & empty)) {
+		if (!(B.get_attacked() & safe) && !(B.st().occ & empty)) {
 			m.tsq(m.fsq() + 2);
 			*mlist++ = m;
 		}
@@ -160,7 +164,7 @@ move::move_t *gen_castling(const board::Board& B, move::move_t *mlist)
 		Bitboard safe = 3ULL << (m.fsq() - 2);	// must not be attacked
 		Bitboard empty = safe | (1ULL << (m.fsq() - 3));	// must be empty
 
-		if (!(B.st().attacked & safe) && !(B.st().occ & empty)) {
+		if (!(B.get_attacked() & safe) && !(B.st().occ & empty)) {
 			m.tsq(m.fsq() - 2);
 			*mlist++ = m;
 		}
@@ -180,7 +184,7 @@ move::move_t *gen_pawn_moves(const board::Board& B, Bitboard targets, move::move
 	const int rc_inc = us ? -NB_FILE + 1 : NB_FILE + 1;	// right capture increment
 	const int sp_inc = us ? -NB_FILE : NB_FILE;		// single push increment
 	const int dp_inc = 2 * sp_inc;					// double push increment
-	const Bitboard fss = B.get_pieces(us, PAWN);
+	const Bitboard fss = B.get_pieces(us, PAWN), pinned = B.get_pinned();
 	const Bitboard enemies = B.get_pieces(them) | B.st().epsq_bb();	// capture targets, incl. epsq
 
 	/* First we calculate the to squares (tss) */
@@ -209,14 +213,14 @@ move::move_t *gen_pawn_moves(const board::Board& B, Bitboard targets, move::move
 		const int tsq = bb::pop_lsb(&tss);
 
 		if (bb::test_bit(tss_sp, tsq))		// can we single push to tsq ?
-			mlist = make_pawn_moves(B, tsq - sp_inc, tsq, mlist, sub_promotions);
+			mlist = make_pawn_moves(B, pinned, tsq - sp_inc, tsq, mlist, sub_promotions);
 		else if (bb::test_bit(tss_dp, tsq))	// can we double push to tsq ?
-			mlist = make_pawn_moves(B, tsq - dp_inc, tsq, mlist, sub_promotions);
+			mlist = make_pawn_moves(B, pinned, tsq - dp_inc, tsq, mlist, sub_promotions);
 		else {	// can we capture tsq ?
 			if (bb::test_bit(tss_lc, tsq))	// can we left capture tsq ?
-				mlist = make_pawn_moves(B, tsq - lc_inc, tsq, mlist, sub_promotions);
+				mlist = make_pawn_moves(B, pinned, tsq - lc_inc, tsq, mlist, sub_promotions);
 			if (bb::test_bit(tss_rc, tsq))	// can we right capture tsq ?
-				mlist = make_pawn_moves(B, tsq - rc_inc, tsq, mlist, sub_promotions);
+				mlist = make_pawn_moves(B, pinned, tsq - rc_inc, tsq, mlist, sub_promotions);
 		}
 	}
 
@@ -231,13 +235,13 @@ move::move_t *gen_evasion(const board::Board& B, move::move_t *mlist)
 	assert(B.is_check());
 	const int us = B.get_turn();
 	const int kpos = B.get_king_pos(us);
-	const Bitboard checkers = B.st().checkers;
+	const Bitboard checkers = B.get_checkers(), pinned = B.get_pinned();
 	const int csq = bb::lsb(checkers);			// checker square
 	const int cpiece = B.get_piece_on(csq);	// checker piece
 	Bitboard tss;
 
 	// normal king escapes
-	tss = bb::kattacks(kpos) & ~B.get_pieces(us) & ~B.st().attacked;
+	tss = bb::kattacks(kpos) & ~B.get_pieces(us) & ~B.get_attacked();
 
 	// The king must also get out of all sliding checkers' firing lines
 	Bitboard _checkers = checkers;
@@ -249,9 +253,9 @@ move::move_t *gen_evasion(const board::Board& B, move::move_t *mlist)
 	}
 
 	// generate King escapes
-	mlist = make_piece_moves(B, kpos, tss, mlist);
+	mlist = make_piece_moves(B, pinned, kpos, tss, mlist);
 
-	if (!bb::several_bits(B.st().checkers)) {
+	if (!bb::several_bits(B.get_checkers())) {
 		// piece moves (only if we're not in double check)
 		tss = is_slider(cpiece)
 			  ? bb::between(kpos, csq)	// cover the check (inc capture the sliding checker)
@@ -274,7 +278,7 @@ move::move_t *gen_quiet_checks(const board::Board& B, move::move_t *mlist)
 	assert(!B.is_check());
 	const int us = B.get_turn(), them = opp_color(us);
 	const int ksq = B.get_king_pos(them);
-	const Bitboard occ = B.st().occ;
+	const Bitboard occ = B.st().occ, pinned = B.get_pinned(), dcheckers = B.get_dcheckers();
 	Bitboard fss, tss;
 
 	// Pawn push checks (single push only)
@@ -296,12 +300,12 @@ move::move_t *gen_quiet_checks(const board::Board& B, move::move_t *mlist)
 			// direct checks
 			tss = attacks & check_squares;
 			// revealed checks
-			if (bb::test_bit(B.st().dcheckers, fsq))
+			if (bb::test_bit(dcheckers, fsq))
 				tss |= attacks & ~bb::direction(ksq, fsq);
 			// exclude captures
 			tss &= ~occ;
 
-			mlist = make_piece_moves(B, fsq, tss, mlist);
+			mlist = make_piece_moves(B, pinned, fsq, tss, mlist);
 		}
 	}
 
@@ -328,5 +332,33 @@ move::move_t *gen_moves(const board::Board& B, move::move_t *mlist)
 	}
 }
 
+bool is_legal(const board::Board& B, move::move_t m)
+/* Tests if m is legal, without generating all moves. Used for TT moves and killers, which may come
+ * from another position, or be garbage (TT key collision). We simply generate the moves of the
+ * piece on fsq to tsq, so that the legality filters are the ones of the generators. */
+{
+	assert(!B.is_check());	// do not use when in check (use gen_evasion)
+	const int us = B.get_turn(), fsq = m.fsq(), tsq = m.tsq();
+	const Bitboard tss = 1ULL << tsq;
+
+	if (!bb::test_bit(B.get_pieces(us), fsq) || bb::test_bit(B.get_pieces(us), tsq))
+		return false;
+
+	move::move_t mlist[MAX_MOVES], *end;
+	const int piece = B.get_piece_on(fsq);
+	const Bitboard pinned = B.get_pinned();
+
+	if (piece == PAWN)
+		end = gen_pawn_moves(B, tss, mlist, true);
+	else if (piece == KING)
+		end = m.flag() == move::CASTLING
+			  ? gen_castling(B, mlist)
+			  : make_piece_moves(B, pinned, fsq, bb::kattacks(fsq) & tss & ~B.get_attacked(), mlist);
+	else
+		end = make_piece_moves(B, pinned, fsq, bb::piece_attack(piece, fsq, B.st().occ) & tss, mlist);
+
+	return std::find(mlist, end, m) != end;
+}
+
 }	// namespace movegen
 
@@ -33,5 +33,7 @@ extern move::move_t *gen_evasion(const board::Board& B, move::move_t *mlist);
 extern move::move_t *gen_quiet_checks(const board::Board& B, move::move_t *mlist);
 extern move::move_t *gen_moves(const board::Board& B, move::move_t *mlist);
 
+extern bool is_legal(const board::Board& B, move::move_t m);
+
 }	// namespace movegen
 
@@ -70,7 +70,7 @@ void Refutation::clear()
 
 MoveSort::MoveSort(const board::Board* _B, int _depth, const SearchInfo *_ss,
 				   const History *_H, const Refutation *_R)
-	: B(_B), ss(_ss), H(_H), R(_R), idx(0), depth(_depth)
+	: B(_B), ss(_ss), H(_H), R(_R), idx(0), count(0), bad(MAX_MOVES), depth(_depth)
 {
 	type = depth > 0 ? GEN_ALL : (depth == 0 ? GEN_CAPTURES_CHECKS : GEN_CAPTURES);
 	/* If we're in check set type = ALL. This affects the sort() and uses SEE instead of MVV/LVA for
@@ -79,10 +79,104 @@ MoveSort::MoveSort(const board::Board* _B, int _depth, const SearchInfo *_ss,
 		type = GEN_ALL;
 
 	refutation = R ? R->get_refutation(B->get_dm_key()) : move::move_t(0);
+	tt_move = move::move_t(0);
+	special[0] = special[1] = special[2] = move::move_t(0);
 
-	move::move_t mlist[MAX_MOVES];
-	count = generate(mlist) - mlist;
-	annotate(mlist);
+	if (depth > 0 && !B->is_check())
+		stage = TT_MOVE;	// nothing to generate yet
+	else {
+		stage = ALL_MOVES;
+		move::move_t mlist[MAX_MOVES];
+		annotate(mlist, generate(mlist) - mlist);
+	}
+}
+
+MoveSort::MoveSort(const board::Board* _B, const move::move_t *mlist, int _count)
+/* Root node: the moves are given by the root move list, and returned in that order. */
+	: B(_B), type(GEN_ALL), stage(ALL_MOVES), ss(nullptr), H(nullptr), R(nullptr), refutation(0),
+	  idx(0), count(_count), bad(MAX_MOVES), depth(1)
+{
+	tt_move = special[0] = special[1] = special[2] = move::move_t(0);
+
+	for (int i = 0; i < count; ++i) {
+		list[i].m = mlist[i];
+		list[i].see = -INF;	// not computed
+		list[i].score = count - i;
+	}
+}
+
+bool MoveSort::next_stage()
+/* Generates the moves of the next stage (possibly none). Returns false when there are no more
+ * stages. */
+{
+	const int us = B->get_turn();
+	move::move_t mlist[MAX_MOVES], *end;
+
+	switch (stage++) {
+	case TT_MOVE:
+		if (ss->best && movegen::is_legal(*B, ss->best))
+			add(tt_move = ss->best, INF);
+		return true;
+
+	case GOOD_CAPTURES:
+		// captures and promotions
+		end = movegen::gen_piece_moves(*B, B->get_pieces(opp_color(us)), mlist, true);
+		end = movegen::gen_pawn_moves(*B, B->get_pieces(opp_color(us)) | B->st().epsq_bb()
+			| bb::eighth_rank(us), end, true);
+
+		for (move::move_t *m = mlist; m < end; ++m)
+			if (*m != tt_move) {
+				const int see = move::see(*B, *m);
+				Token& t = see >= 0 ? list[count++] : list[--bad];
+				t.m = *m;
+				t.score = t.see = see;
+			}
+		return true;
+
+	case KILLERS: {
+		const move::move_t candidates[3] = {ss->killer[0], ss->killer[1], refutation};
+		for (int i = 0; i < 3; ++i) {
+			const move::move_t m = candidates[i];
+			if (m && !returned_early(m) && !move::is_cop(*B, m) && movegen::is_legal(*B, m))
+				add(special[i] = m, History::Max - 1 - i);
+		}
+		return true;
+	}
+
+	case QUIETS:
+		end = movegen::gen_castling(*B, mlist);
+		end = movegen::gen_piece_moves(*B, ~B->st().occ, end, true);
+		end = movegen::gen_pawn_moves(*B, ~B->st().occ & ~bb::eighth_rank(us) & ~B->st().epsq_bb(),
+			end, true);
+
+		for (move::move_t *m = mlist; m < end; ++m)
+			if (!returned_early(*m))
+				add(*m, H->get(*B, *m));
+		return true;
+
+	case BAD_CAPTURES:
+		// move them next to the other moves (count <= bad, so a forward copy is safe)
+		while (bad < MAX_MOVES)
+			list[count++] = list[bad++];
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+bool MoveSort::returned_early(move::move_t m) const
+// Was m already returned by the TT_MOVE or KILLERS stage ?
+{
+	return m == tt_move || m == special[0] || m == special[1] || m == special[2];
+}
+
+void MoveSort::add(move::move_t m, int score)
+{
+	Token& t = list[count++];
+	t.m = m;
+	t.score = score;
+	t.see = -INF;	// not computed
 }
 
 move::move_t *MoveSort::generate(move::move_t *mlist)
@@ -115,11 +209,11 @@ move::move_t *MoveSort::generate(move::move_t *mlist)
 	}
 }
 
-void MoveSort::annotate(const move::move_t *mlist)
+void MoveSort::annotate(const move::move_t *mlist, int n)
 {
-	for (int i = idx; i < count; ++i) {
-		list[i].m = mlist[i];
-		score(&list[i]);
+	for (int i = 0; i < n; ++i, ++count) {
+		list[count].m = mlist[i];
+		score(&list[count]);
 	}
 }
 
@@ -150,17 +244,31 @@ void MoveSort::score(MoveSort::Token *t)
 	}
 }
 
-move::move_t MoveSort::next(int *see)
+move::move_t MoveSort::next()
+{
+	// current stage exhausted: generate the next one(s)
+	while (idx == count)
+		if (!next_stage())
+			return move::move_t(0);
+
+	std::swap(list[idx], *std::max_element(&list[idx], &list[count]));
+	return list[idx++].m;
+}
+
+int MoveSort::see()
+{
+	assert(idx > 0);
+	Token& t = list[idx - 1];
+	if (t.see == -INF)
+		t.see = move::see(*B, t.m);	// compute and cache
+	return t.see;
+}
+
+bool MoveSort::see_ge(int threshold) const
 {
-	if (idx < count) {
-		std::swap(list[idx], *std::max_element(&list[idx], &list[count]));
-		const Token& t = list[idx++];
-		*see = t.see == -INF
-			   ? move::see(*B, t.m)	// compute SEE
-			   : t.see;				// use SEE cache
-		return t.m;
-	} else
-		return move::move_t(0);
+	assert(idx > 0);
+	const Token& t = list[idx - 1];
+	return t.see == -INF ? move::see_ge(*B, t.m, threshold) : t.see >= threshold;
 }
 
 move::move_t MoveSort::previous()
@@ -66,6 +66,16 @@ private:
 	Entry r[count];
 };
 
+/* Move ordering, and lazy generation. In the main search (when not in check), moves are generated in
+ * stages, each one only when the previous one is exhausted:
+ * - TT move (verified by movegen::is_legal()).
+ * - good captures (SEE >= 0), by descending SEE. Bad captures are put aside for later.
+ * - killers, and refutation (also verified by movegen::is_legal()).
+ * - quiet moves, by history.
+ * - bad captures, by descending SEE.
+ * Most cut nodes fail high on the TT move or a killer, which saves generating and sorting moves we
+ * will never search. In the QS, and in check, all moves are generated at once (ALL_MOVES).
+ * */
 class MoveSort {
 public:
 	enum GenType {
@@ -74,6 +84,12 @@ public:
 		GEN_CAPTURES			// captures only
 	};
 
+	enum Stage {
+		TT_MOVE, GOOD_CAPTURES, KILLERS, QUIETS, BAD_CAPTURES,	// staged generation
+		ALL_MOVES,	// generated at once
+		DONE
+	};
+
 	struct Token {
 		int score, see;
 		move::move_t m;
@@ -85,10 +101,17 @@ public:
 
 	MoveSort(const board::Board* _B, int _depth, const SearchInfo *_ss,
 			 const History *_H, const Refutation *_R);
+	MoveSort(const board::Board* _B, const move::move_t *mlist, int _count);
 
-	move::move_t next(int *see);
+	move::move_t next();
 	move::move_t previous();
 
+	/* SEE of the last move returned by next(). Use see_ge() when the exact value is not needed: it
+	 * is much cheaper, unless the SEE is already known (captures, in the main search). */
+	int see();
+	bool see_ge(int threshold) const;
+
+	// number of moves generated so far (ie. all legal moves, once next() has returned 0)
 	int get_count() const {
 		return count;
 	}
@@ -96,16 +119,25 @@ public:
 private:
 	const board::Board *B;
 	GenType type;
+	int stage;
 	const SearchInfo *ss;
 	const History *H;
 	const Refutation *R;
 	move::move_t refutation;
 
+	/* list[0..idx-1] have been returned by next(), and list[idx..count-1] are the moves of the
+	 * current stage. Bad captures are put aside at the end: list[bad..MAX_MOVES-1]. */
 	Token list[MAX_MOVES];
-	int idx, count, depth;
+	int idx, count, bad, depth;
+
+	move::move_t tt_move;		// if returned by the TT_MOVE stage (ss->best changes as moves are searched)
+	move::move_t special[3];	// killers and refutation, if returned by the KILLERS stage
+
+	bool next_stage();
+	bool returned_early(move::move_t m) const;
+	void add(move::move_t m, int score);
 
 	move::move_t *generate(move::move_t *mlist);
-	void annotate(const move::move_t *mlist);
+	void annotate(const move::move_t *mlist, int n);
 	void score(MoveSort::Token *t);
 };
-
@@ -0,0 +1,262 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * Credits:
+ * - Efficiently updatable neural networks were introduced in Shogi by Yu Nasu, and ported to chess
+ * in Stockfish. The HalfKP feature set and the quantization scheme follow them.
+*/
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "nnue.h"
+#include "board.h"
+#include "prng.h"
+
+namespace {
+
+const char Magic[8] = "DCNNUE";
+const uint32_t Version = 1;
+
+const int WeightShift = 6;	// hidden layers: int32 sums are divided by 64, and clipped to 0..127
+const int OutputScale = 16;	// output layer: 16 units per centipawn
+
+struct Network {
+	int16_t ft_bias[nnue::L1];
+	int16_t ft_weights[nnue::Features * nnue::L1];
+	int32_t l2_bias[nnue::L2];
+	int8_t l2_weights[nnue::L2 * 2 * nnue::L1];
+	int32_t l3_bias[nnue::L3];
+	int8_t l3_weights[nnue::L3 * nnue::L2];
+	int32_t out_bias;
+	int8_t out_weights[nnue::L3];
+};
+
+std::unique_ptr<Network> net;
+
+template <typename T>
+bool read(FILE *f, T *data, size_t count)
+{
+	return fread(data, sizeof(T), count, f) == count;
+}
+
+void transform(const int16_t *in, uint8_t *out, int n)
+// clipped ReLU of the accumulator: 0..127
+{
+#ifdef __AVX2__
+	const __m256i zero = _mm256_setzero_si256();
+	for (int i = 0; i < n; i += 32) {
+		const __m256i a = _mm256_loadu_si256((const __m256i *)(in + i));
+		const __m256i b = _mm256_loadu_si256((const __m256i *)(in + i + 16));
+		// packs works within 128-bit lanes: restore the order of the 64-bit blocks
+		const __m256i p = _mm256_max_epi8(_mm256_packs_epi16(a, b), zero);
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(p, 0xD8));
+	}
+#else
+	for (int i = 0; i < n; ++i)
+		out[i] = std::max<int>(0, std::min<int>(127, in[i]));
+#endif
+}
+
+template <int n_in, int n_out>
+void dense(const uint8_t *in, const int8_t *w, const int32_t *bias, int32_t *out)
+// out = bias + w.in, where w is n_out rows of n_in weights
+{
+	static_assert(n_in % 32 == 0, "inputs are processed by blocks of 32");
+#ifdef __AVX2__
+	const __m256i ones = _mm256_set1_epi16(1);
+	auto dot = [&](const int8_t *row, int i, __m256i sum) {
+		const __m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+		const __m256i y = _mm256_loadu_si256((const __m256i *)(row + i));
+		// u8 x i8 products, summed by pairs (no saturation, as inputs are <= 127), then by 4
+		return _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(x, y), ones));
+	};
+
+	for (int o = 0; o + 4 <= n_out; o += 4) {
+		// 4 rows at a time, so that the horizontal sums are shared
+		const int8_t *row = w + o * n_in;
+		__m256i s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0;
+		for (int i = 0; i < n_in; i += 32) {
+			s0 = dot(row, i, s0);
+			s1 = dot(row + n_in, i, s1);
+			s2 = dot(row + 2 * n_in, i, s2);
+			s3 = dot(row + 3 * n_in, i, s3);
+		}
+		const __m256i s = _mm256_hadd_epi32(_mm256_hadd_epi32(s0, s1), _mm256_hadd_epi32(s2, s3));
+		const __m128i r = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+		const __m128i b = _mm_loadu_si128((const __m128i *)(bias + o));
+		_mm_storeu_si128((__m128i *)(out + o), _mm_add_epi32(r, b));
+	}
+
+	for (int o = n_out & ~3; o < n_out; ++o) {
+		const int8_t *row = w + o * n_in;
+		__m256i sum = _mm256_setzero_si256();
+		for (int i = 0; i < n_in; i += 32)
+			sum = dot(row, i, sum);
+		__m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+		s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+		s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+		out[o] = bias[o] + _mm_cvtsi128_si32(s);
+	}
+#else
+	for (int o = 0; o < n_out; ++o) {
+		const int8_t *row = w + o * n_in;
+		int32_t sum = bias[o];
+		for (int i = 0; i < n_in; ++i)
+			sum += in[i] * row[i];
+		out[o] = sum;
+	}
+#endif
+}
+
+void clip(const int32_t *in, uint8_t *out, int n)
+{
+	for (int i = 0; i < n; ++i)
+		out[i] = std::max(0, std::min(127, in[i] >> WeightShift));
+}
+
+}	// namespace
+
+namespace nnue {
+
+bool load(const std::string& file_name)
+{
+	FILE *f = fopen(file_name.c_str(), "rb");
+	if (!f)
+		return false;
+
+	char magic[8];
+	uint32_t version, dims[4];
+	std::unique_ptr<Network> n(new Network);
+
+	const bool ok = read(f, magic, 8) && !std::memcmp(magic, Magic, sizeof(Magic))
+		&& read(f, &version, 1) && version == Version
+		&& read(f, dims, 4) && dims[0] == Features && dims[1] == L1 && dims[2] == L2 && dims[3] == L3
+		&& read(f, n->ft_bias, L1) && read(f, n->ft_weights, Features * L1)
+		&& read(f, n->l2_bias, L2) && read(f, n->l2_weights, L2 * 2 * L1)
+		&& read(f, n->l3_bias, L3) && read(f, n->l3_weights, L3 * L2)
+		&& read(f, &n->out_bias, 1) && read(f, n->out_weights, L3)
+		&& fgetc(f) == EOF;
+	fclose(f);
+
+	if (ok)
+		net = std::move(n);
+	return ok;
+}
+
+void init_random(uint64_t seed)
+/* Weights are scaled so that activations spread over the clipped range, which is all that matters
+ * for speed measurements: the eval itself is meaningless. */
+{
+	PRNG prng;
+	prng.init(seed);
+	auto rnd = [&](int range) { return (int)(prng.rand() % (2 * range + 1)) - range; };
+
+	net.reset(new Network);
+	for (auto& b : net->ft_bias) b = 32 + rnd(32);
+	for (auto& w : net->ft_weights) w = rnd(8);
+	for (auto& b : net->l2_bias) b = rnd(1 << 12);
+	for (auto& w : net->l2_weights) w = rnd(16);
+	for (auto& b : net->l3_bias) b = rnd(1 << 12);
+	for (auto& w : net->l3_weights) w = rnd(64);
+	net->out_bias = 0;
+	for (auto& w : net->out_weights) w = rnd(64);
+}
+
+void clear()
+{
+	net.reset();
+}
+
+bool enabled()
+{
+	return (bool)net;
+}
+
+int feature(int perspective, int ksq, int color, int piece, int sq)
+{
+	assert(piece_ok(piece) && piece != KING);
+	const int flip = perspective == WHITE ? 0 : 56;
+	return (((ksq ^ flip) * 10 + piece + (color == perspective ? 0 : 5)) << 6) + (sq ^ flip);
+}
+
+void add_feature(int16_t *acc, int index)
+{
+	const int16_t *w = net->ft_weights + index * L1;
+#ifdef __AVX2__
+	for (int i = 0; i < L1; i += 16) {
+		const __m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+		const __m256i b = _mm256_loadu_si256((const __m256i *)(w + i));
+		_mm256_storeu_si256((__m256i *)(acc + i), _mm256_add_epi16(a, b));
+	}
+#else
+	for (int i = 0; i < L1; ++i)
+		acc[i] += w[i];
+#endif
+}
+
+void sub_feature(int16_t *acc, int index)
+{
+	const int16_t *w = net->ft_weights + index * L1;
+#ifdef __AVX2__
+	for (int i = 0; i < L1; i += 16) {
+		const __m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+		const __m256i b = _mm256_loadu_si256((const __m256i *)(w + i));
+		_mm256_storeu_si256((__m256i *)(acc + i), _mm256_sub_epi16(a, b));
+	}
+#else
+	for (int i = 0; i < L1; ++i)
+		acc[i] -= w[i];
+#endif
+}
+
+void refresh(const board::Board& B, int perspective, int16_t *acc)
+{
+	std::memcpy(acc, net->ft_bias, sizeof(net->ft_bias));
+	const int ksq = B.get_king_pos(perspective);
+
+	for (int color = WHITE; color <= BLACK; ++color)
+		for (int piece = PAWN; piece < KING; ++piece) {
+			Bitboard b = B.get_pieces(color, piece);
+			while (b)
+				add_feature(acc, feature(perspective, ksq, color, piece, bb::pop_lsb(&b)));
+		}
+}
+
+int evaluate(const board::Board& B)
+{
+	assert(net);
+	const Accumulator& acc = B.get_accumulator();
+	const int us = B.get_turn();
+
+	uint8_t input[2 * L1], h2[L2], h3[L3];
+	int32_t sum2[L2], sum3[L3], out;
+
+	transform(acc.v[us], input, L1);
+	transform(acc.v[opp_color(us)], input + L1, L1);
+
+	dense<2 * L1, L2>(input, net->l2_weights, net->l2_bias, sum2);
+	clip(sum2, h2, L2);
+	dense<L2, L3>(h2, net->l3_weights, net->l3_bias, sum3);
+	clip(sum3, h3, L3);
+	dense<L3, 1>(h3, net->out_weights, &net->out_bias, &out);
+
+	const int max_eval = MATE - MAX_PLY - 1;	// never mistaken for a mate score
+	return std::max(-max_eval, std::min(max_eval, out / OutputScale));
+}
+
+}	// namespace nnue
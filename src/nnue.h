@@ -0,0 +1,53 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+#include "types.h"
+
+namespace board {
+class Board;
+}
+
+/* Optional network evaluation (NNUE). Features are (king square, piece, square) for each
+ * perspective, kings excluded: 64 x 10 x 64 inputs, flipped vertically for Black. The first layer
+ * (the accumulator) is updated incrementally by the Board, and the small dense layers that follow
+ * are computed at each eval, with int8 weights:
+ *   2 x L1 (clipped to 0..127, side to move first) -> L2 -> L3 -> 1
+ *
+ * File format (little endian): Magic, version, the 4 dimensions (uint32), then ft_bias (int16[L1]),
+ * ft_weights (int16[Features][L1]), l2_bias (int32[L2]), l2_weights (int8[L2][2 * L1]), l3_bias
+ * (int32[L3]), l3_weights (int8[L3][L2]), out_bias (int32), out_weights (int8[L3]). */
+namespace nnue {
+
+const int Features = 64 * 10 * 64;
+const int L1 = 256, L2 = 32, L3 = 32;
+
+struct Accumulator {
+	int16_t v[NB_COLOR][L1];	// by perspective
+};
+
+extern bool load(const std::string& file_name);
+extern void init_random(uint64_t seed);	// random weights, to measure the speed without a network
+extern void clear();
+extern bool enabled();	// a network is loaded
+
+extern int feature(int perspective, int ksq, int color, int piece, int sq);
+extern void add_feature(int16_t *acc, int index);
+extern void sub_feature(int16_t *acc, int index);
+extern void refresh(const board::Board& B, int perspective, int16_t *acc);
+
+extern int evaluate(const board::Board& B);
+
+}	// namespace nnue
@@ -0,0 +1,279 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * Credits:
+ * - Lockless hashing (key xor data) is due to Robert Hyatt and Tim Mann.
+*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "perft.h"
+#include "movegen.h"
+
+using namespace std::chrono;
+
+namespace {
+
+// http://chessprogramming.wikispaces.com/Perft+Results
+const char *BuiltinEPD[] = {
+	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 ;D6 119060324",
+	"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ;D5 193690690",
+	"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - ;D7 178633661",
+	"r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1 ;D6 706045033",
+	"rnbqkb1r/pp1p1ppp/2p5/4P3/2B5/8/PPP1NnPP/RNBQK2R w KQkq - 0 6 ;D5 70202861",
+	nullptr
+};
+
+class PerftHash {
+/* Subtree counts, indexed by (key, depth), and shared by all threads without locking: an entry
+ * stores key ^ data next to data, so that an entry torn by concurrent writes fails the key test,
+ * rather than returning a wrong count. Buckets have a depth-preferred and an always-replace entry. */
+public:
+	explicit PerftHash(int mb);
+	bool probe(Key key, int depth, uint64_t& count) const;
+	void store(Key key, int depth, uint64_t count);
+
+private:
+	struct Entry {
+		uint64_t check, data;	// data = count << 8 | depth
+	};
+	struct Bucket {
+		Entry deep, recent;
+	};
+	std::vector<Bucket> bucket;
+	size_t mask;
+};
+
+PerftHash::PerftHash(int mb)
+{
+	bucket.resize(1ULL << bb::msb(std::max<uint64_t>(((uint64_t)mb << 20) / sizeof(Bucket), 1)));
+	mask = bucket.size() - 1;
+}
+
+bool PerftHash::probe(Key key, int depth, uint64_t& count) const
+{
+	const Bucket& b = bucket[key & mask];
+
+	for (const Entry *e : {&b.deep, &b.recent}) {
+		const uint64_t data = e->data;
+		if ((e->check ^ data) == key && (int)(data & 0xff) == depth) {
+			count = data >> 8;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void PerftHash::store(Key key, int depth, uint64_t count)
+{
+	Bucket& b = bucket[key & mask];
+	Entry& e = depth >= (int)(b.deep.data & 0xff) ? b.deep : b.recent;
+	e.data = count << 8 | depth;
+	e.check = key ^ e.data;
+}
+
+uint64_t count_leaves(board::Board& B, int depth, PerftHash *H)
+{
+	uint64_t count;
+	Key key = 0;
+
+	if (depth >= 2 && H) {
+		key = B.get_key();
+		if (H->probe(key, depth, count))
+			return count;
+	}
+
+	move::move_t mlist[MAX_MOVES];
+	move::move_t *end = movegen::gen_moves(B, mlist);
+
+	// bulk counting: the moves are legal, so leaves don't need to be played
+	if (depth <= 1)
+		return depth == 1 ? end - mlist : 1;
+
+	count = 0;
+	for (move::move_t *m = mlist; m != end; ++m) {
+		B.play(*m);
+		count += count_leaves(B, depth - 1, H);
+		B.undo();
+	}
+
+	if (H)
+		H->store(key, depth, count);
+
+	return count;
+}
+
+uint64_t run(const board::Board& B, int depth, int threads, PerftHash *H, bool divide)
+/* Threads pick the next root move, and search its subtree on their own copy of the board. All
+ * subtree counts are kept, to display them in move generation order. */
+{
+	move::move_t mlist[MAX_MOVES];
+	const int n = movegen::gen_moves(B, mlist) - mlist;
+
+	if (depth <= 1 && !divide)
+		return depth == 1 ? n : 1;
+
+	std::vector<uint64_t> counts(n);
+	std::atomic<int> next(0);
+
+	auto worker = [&] {
+		board::Board b(B);
+		for (int i; (i = next++) < n; ) {
+			b.play(mlist[i]);
+			counts[i] = count_leaves(b, depth - 1, H);
+			b.undo();
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (int i = 1; i < std::min(threads, n); ++i)
+		pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool)
+		t.join();
+
+	uint64_t total = 0;
+	for (int i = 0; i < n; ++i) {
+		total += counts[i];
+		if (divide)
+			std::cout << move_to_string(mlist[i]) << '\t' << counts[i] << std::endl;
+	}
+
+	return total;
+}
+
+bool parse_epd(const std::string& line, std::string& fen, std::vector<uint64_t>& expected)
+/* Parses a perftsuite line: a FEN followed by the expected counts, eg. "<fen> ;D1 20 ;D2 400".
+ * expected[d] is the count at depth d (0 if not given). Returns false for empty lines and comments. */
+{
+	std::istringstream is(line);
+	std::string field;
+
+	if (!getline(is, fen, ';') || fen.find_first_not_of(" \t\r") == std::string::npos || fen[0] == '#')
+		return false;
+	fen.erase(fen.find_last_not_of(" \t\r") + 1);
+
+	expected.clear();
+	while (getline(is, field, ';')) {
+		std::istringstream fs(field);
+		char d;
+		int depth;
+		uint64_t count;
+		if (fs >> d >> depth >> count && (d == 'D' || d == 'd') && depth > 0) {
+			if ((int)expected.size() <= depth)
+				expected.resize(depth + 1);
+			expected[depth] = count;
+		}
+	}
+
+	return true;
+}
+
+}	// namespace
+
+uint64_t perft(const board::Board& B, int depth, int threads, int hash, bool divide)
+{
+	std::unique_ptr<PerftHash> H(hash > 0 && depth > 2 ? new PerftHash(hash) : nullptr);
+	return run(B, depth, threads, H.get(), divide);
+}
+
+bool perft_suite(int argc, char **argv)
+{
+	std::ifstream epd;
+	int i = 2;
+
+	if (argc > 2 && std::string(argv[2]).compare(0, 2, "--")) {
+		epd.open(argv[2]);
+		if (!epd.is_open()) {
+			std::cerr << "cannot open " << argv[2] << std::endl;
+			return false;
+		}
+		++i;
+	}
+
+	int max_depth = 0, threads = std::max<int>(std::thread::hardware_concurrency(), 1), hash = 32;
+	for (; i < argc; i += 2) {
+		const std::string option(argv[i]);
+		if (i + 1 >= argc || (option != "--depth" && option != "--threads" && option != "--hash")) {
+			std::cerr << "usage: " << argv[0] << " perft [file.epd] [--depth d] [--threads n]"
+				" [--hash mb]" << std::endl;
+			return false;
+		}
+		const int value = std::atoi(argv[i + 1]);
+		if (option == "--depth")
+			max_depth = value;
+		else if (option == "--threads")
+			threads = std::max(value, 1);
+		else
+			hash = std::max(value, 0);
+	}
+
+	// the hash table is kept between positions: (key, depth) -> count doesn't depend on the root
+	std::unique_ptr<PerftHash> H(hash ? new PerftHash(hash) : nullptr);
+	board::Board B;
+	std::string line, fen;
+	std::vector<uint64_t> expected;
+	uint64_t total = 0;
+	int positions = 0, errors = 0;
+
+	const auto start = high_resolution_clock::now();
+
+	for (int p = 0; epd.is_open() ? (bool)getline(epd, line) : BuiltinEPD[p] != nullptr; ++p) {
+		if (!epd.is_open())
+			line = BuiltinEPD[p];
+		if (!parse_epd(line, fen, expected))
+			continue;
+
+		// deepest expected count within max_depth, or max_depth if there is none
+		int depth = (int)expected.size() - 1;
+		if (max_depth)
+			depth = std::min(depth, max_depth);
+		while (depth > 0 && !expected[depth])
+			--depth;
+		if (depth <= 0 && !(depth = max_depth))
+			continue;
+
+		B.set_fen(fen);
+		const auto t0 = high_resolution_clock::now();
+		const uint64_t count = run(B, depth, threads, H.get(), false);
+		const int64_t usec = std::max<int64_t>(duration_cast<microseconds>(
+			high_resolution_clock::now() - t0).count(), 1);
+
+		std::cout << fen << "\tD" << depth << ' ' << count << '\t' << usec / 1000 << " ms\t"
+			<< (uint64_t)(count / (double)usec * 1e6) << " leaf/sec";
+		if (depth < (int)expected.size() && expected[depth] && count != expected[depth]) {
+			std::cout << "\tincorrect perft (expected " << expected[depth] << ")";
+			++errors;
+		}
+		std::cout << std::endl;
+
+		total += count;
+		++positions;
+	}
+
+	const int64_t usec = std::max<int64_t>(duration_cast<microseconds>(
+		high_resolution_clock::now() - start).count(), 1);
+	std::cout << "positions: " << positions << ", errors: " << errors << std::endl;
+	std::cout << "speed: " << (uint64_t)(total / (double)usec * 1e6) << " leaf/sec" << std::endl;
+
+	return !errors;
+}
@@ -0,0 +1,27 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "board.h"
+
+/* Counts the leaves of the legal move tree of depth plies: root moves are split between threads,
+ * and subtree counts are cached in a hash table of hash MB (none if hash = 0). If divide is set,
+ * the count of each root move is displayed. */
+extern uint64_t perft(const board::Board& B, int depth, int threads, int hash, bool divide);
+
+/* Perft suite, from the command line (the built-in positions if no file is given):
+ * discocheck perft [file.epd] [--depth d] [--threads n] [--hash mb]
+ * Each line of the file is a FEN followed by the expected counts, eg. "<fen> ;D1 20 ;D2 400". Returns
+ * false if a count is incorrect. */
+extern bool perft_suite(int argc, char **argv);
@@ -38,21 +38,21 @@ const int KFile[8]	= { +3, +4, +2, +0, +0, +2, +4, +3};
 const int KRank[8]	= { +1, +0, -2, -3, -4, -5, -6, -7};
 
 /* Weight */
-const int BCentreOpening = 2;
-const int BCentreEndgame = 3;
-const int RFileOpening = 3;
-const int QCentreEndgame = 4;
+int BCentreOpening = 2;
+int BCentreEndgame = 3;
+int RFileOpening = 3;
+int QCentreEndgame = 4;
 
 // CLOP
-const int KCentreEndgame = 14, KFileOpening = 10, KRankOpening = 7;
-const int NCentreOpening = 10, NCentreEndgame = 3;
+int KCentreEndgame = 14, KFileOpening = 10, KRankOpening = 7;
+int NCentreOpening = 10, NCentreEndgame = 3;
 
 /* Adjustments */
-const int PCenterOpening = 18;
-const int BDiagonalOpening = 4;
-const int BBackRankOpening = 10;
-const int QBackRankOpening = 5;
-const int RSeventhRank = 8;
+int PCenterOpening = 18;
+int BDiagonalOpening = 4;
+int BBackRankOpening = 10;
+int QBackRankOpening = 5;
+int RSeventhRank = 8;
 
 Eval psq_bonus(int piece, int sq)
 {
@@ -120,6 +120,20 @@ void init()
 	}
 }
 
+void params(std::vector<Param>& p)
+{
+	const int max = 100;
+	p.insert(p.end(), {
+		{"BCentreOpening", &BCentreOpening, 0, max}, {"BCentreEndgame", &BCentreEndgame, 0, max},
+		{"RFileOpening", &RFileOpening, 0, max}, {"QCentreEndgame", &QCentreEndgame, 0, max},
+		{"KCentreEndgame", &KCentreEndgame, 0, max}, {"KFileOpening", &KFileOpening, 0, max},
+		{"KRankOpening", &KRankOpening, 0, max}, {"NCentreOpening", &NCentreOpening, 0, max},
+		{"NCentreEndgame", &NCentreEndgame, 0, max}, {"PCenterOpening", &PCenterOpening, 0, max},
+		{"BDiagonalOpening", &BDiagonalOpening, 0, max}, {"BBackRankOpening", &BBackRankOpening, 0, max},
+		{"QBackRankOpening", &QBackRankOpening, 0, max}, {"RSeventhRank", &RSeventhRank, 0, max}
+	});
+}
+
 Eval table(int color, int piece, int sq)
 {
 	assert(color_ok(color) && piece_ok(piece) && square_ok(sq));
@@ -13,11 +13,13 @@
 * see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <vector>
 #include "types.h"
 
 namespace psq {
 
-extern void init();
+extern void init();	// must be called again when parameters are changed
+extern void params(std::vector<Param>& p);	// appends the PSQ parameters
 extern Eval material(int p);
 extern Eval table(int color, int piece, int sq);
 
@@ -12,11 +12,20 @@
  * You should have received a copy of the GNU General Public License along with this program. If not,
  * see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
 #include <chrono>
+#include <iomanip>
+#include <sstream>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 #include "search.h"
 #include "uci.h"
 #include "eval.h"
+#include "nnue.h"
 #include "psq.h"
 #include "movesort.h"
 #include "prng.h"
@@ -25,61 +34,38 @@ using namespace std::chrono;
 
 namespace search {
 
-TTable TT;
-Refutation R;
-
-uint64_t node_count;
+Context engine;
+std::atomic<bool> stop_signal, ponderhit_signal;
 
 }	// namespace search
 
 namespace {
 
-bool can_abort, pondering;
-struct AbortSearch {};
-struct ForcedMove {};
-
-uint64_t node_limit;
-int time_limit[2], time_allowed;
-time_point<high_resolution_clock> start;
-
-History H;
+// Counts a search statistic (compiled out, unless STATS is defined)
+#ifdef STATS
+#define STAT(counter) (++stats.counter)
+#else
+#define STAT(counter) ((void)0)
+#endif
 
 // Formulas tuned by CLOP
 int razor_margin(int depth)	  { return 73 * depth + 145; }
 int eval_margin(int depth)	  { return 37 * depth + 111; }
 int null_reduction(int depth) { return (13 * depth + 72) / 32; }
 
-int DrawScore[NB_COLOR];	// Contempt draw score by color
-
-move::move_t pv[MAX_PLY+1][MAX_PLY+1];
-move::move_t best_move, ponder_move;
-bool best_move_changed;
-
-void node_poll()
-{
-	if ((++search::node_count & 255) == 0 && can_abort) {
-		bool abort = false;
-
-		// node limit reached ?
-		if (node_limit && search::node_count >= node_limit)
-			abort = true;
-		// time limit reached ?
-		else if (time_allowed && duration_cast<milliseconds>
-				 (high_resolution_clock::now() - start).count() > time_allowed)
-			abort = true;
-
-		// limit reached: abort search, unless we're pondering
-		if (abort && !pondering)
-			throw AbortSearch();
-
-		// handle input during search
-		std::string token = uci::check_input();
-		if (token == "stop")
-			throw AbortSearch();
-		else if (token == "ponderhit")
-			pondering = false;
+/* Root move list. Moves are searched in this order at the root, which is the order of the previous
+ * iteration (best first, then by node count). Each root move keeps its own score and PV, so that
+ * several lines can be searched and reported in the same iterative deepening (MultiPV). */
+struct RootMove {
+	move::move_t m;
+	int score, prev_score;	// -INF if the move failed low
+	uint64_t nodes;			// spent searching this move, since the start of the search
+	move::move_t pv[MAX_PLY+1];
+
+	bool operator< (const RootMove& rm) const {
+		return score != rm.score ? score > rm.score : nodes > rm.nodes;	// best first
 	}
-}
+};
 
 static bool is_mate_score(int score)
 {
@@ -128,6 +114,8 @@ bool can_return_tt(const TTable::Entry *tte, int depth, int beta, int ply)
 
 void time_alloc(const search::Limits& sl, int result[2])
 {
+	result[0] = result[1] = 0;	// no time limit
+
 	if (sl.movetime > 0)
 		result[0] = result[1] = sl.movetime;
 	else if (sl.time > 0 || sl.inc > 0) {
@@ -137,14 +125,176 @@ void time_alloc(const search::Limits& sl, int result[2])
 	}
 }
 
-int qsearch(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
+}	// namespace
+
+namespace search {
+
+/* Lazy SMP: each Worker runs its own iterative deepening on a copy of the root position, and
+ * threads only communicate through the shared TT. Worker 0 is the main thread: it handles time
+ * management, node limits and UCI output, and its best move is the one that gets played. The
+ * helpers (id > 0) simply search until the main thread raises the stop flag. */
+class Worker {
+public:
+	Worker(Context *_ctx, int _id): ctx(_ctx), id(_id), node_count(0) {
+		R.clear();
+	}
+
+	void init_search(const board::Board& root, const std::vector<move::move_t>& searchmoves);
+	void iterate(int max_depth);
+
+	Context * const ctx;
+	const int id;
+	board::Board pos;
+	std::atomic<uint64_t> node_count;
+
+	move::move_t best_move, ponder_move;
+	bool best_move_changed;
+
+	std::vector<RootMove> root_moves;
+	Result result;	// last completed iteration (main thread only)
+	int seldepth;	// maximum ply reached
+	Stats stats;
+
+	History H;
+	Refutation R;
+	eval::EvalCache EC;
+	eval::PawnCache PC;
+	eval::MaterialCache MC;
+
+private:
+	SearchInfo stack[MAX_PLY + 1];
+	move::move_t pv[MAX_PLY+1][MAX_PLY+1];
+
+	bool aborted;	// set by node_poll(): unwind the search, ignoring all scores returned
+	bool forced_move;	// only one legal move at the root
+	size_t pv_idx;	// MultiPV line being searched: root_moves[0..pv_idx-1] are excluded
+
+	bool node_poll();
+	void prefetch(const board::Board& B, move::move_t m);
+	int evaluate(const board::Board& B);
+	void update_killers(const board::Board& B, SearchInfo *ss);
+
+	int qsearch(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss);
+	template <bool root>
+	int pvs(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss);
+};
+
+Context::Context(): uci_output(true) {}
+
+Context::~Context() {}	// Worker is only complete here
+
+int Context::elapsed_msec() const
+{
+	return duration_cast<milliseconds>(high_resolution_clock::now() - start).count();
+}
+
+void Context::set_time_allowed(int msec)
+{
+	std::lock_guard<std::mutex> lock(timer_mtx);
+	time_allowed = msec;
+	timer_cv.notify_one();	// let the timer compute its next deadline
+}
+
+void Context::timer_loop()
+{
+	const int hard_deadline = time_limit[1] + uci::TimeBuffer / 2;
+	std::unique_lock<std::mutex> lock(timer_mtx);
+
+	while (!timer_done) {
+		const int elapsed = elapsed_msec();
+		time_up = elapsed > time_allowed;
+		hard_stop = elapsed > hard_deadline;
+
+		if (hard_stop)
+			timer_cv.wait(lock);
+		else {
+			const int deadline = time_up ? hard_deadline : std::min(time_allowed, hard_deadline);
+			timer_cv.wait_for(lock, milliseconds(deadline - elapsed + 1));
+		}
+	}
+}
+
+uint64_t Context::total_nodes() const
+{
+	uint64_t total = 0;
+	for (auto& w : workers)
+		total += w->node_count.load(std::memory_order_relaxed);
+	return total;
+}
+
+int Worker::evaluate(const board::Board& B)
+// symmetric_eval() or the network, through the eval cache (the TT eval is often lost, when the entry
+// is replaced). The key must include castling rights, which are used by symmetric_eval().
+{
+	const Key key = B.get_key();
+	int e;
+
+	if (!EC.probe(key, e))
+		EC.store(key, e = nnue::enabled() ? nnue::evaluate(B) : eval::symmetric_eval(B, PC, MC));
+
+	return e;
+}
+
+void Worker::prefetch(const board::Board& B, move::move_t m)
+// Entries of the child node, before play(m): their cache misses overlap with play() and node_poll()
+{
+	Key kpkey;
+	const Key key = B.key_after(m, kpkey);
+	ctx->TT.prefetch(key);
+	EC.prefetch(key);
+	if (!nnue::enabled())
+		PC.prefetch(kpkey);	// only used by symmetric_eval(), on an eval cache miss
+}
+
+bool Worker::node_poll()
+// Counts nodes and checks all the reasons to abort the search. Returns true if aborted.
+{
+	// Only this thread writes node_count, other threads only read it: no need for a locked increment
+	const uint64_t nodes = node_count.load(std::memory_order_relaxed) + 1;
+	node_count.store(nodes, std::memory_order_relaxed);
+
+	if (aborted)
+		return true;
+
+	if (id) {
+		// helper thread: stop when the main thread says so
+		if ((nodes & 255) == 0 && ctx->stop.load(std::memory_order_relaxed))
+			aborted = true;
+		return aborted;
+	}
+
+	// stop command received by the input thread
+	if (ctx->can_abort && search::stop_signal.load(std::memory_order_relaxed))
+		return aborted = true;
+
+	if ((nodes & 255) == 0) {
+		if (ctx->pondering && search::ponderhit_signal.load(std::memory_order_relaxed))
+			ctx->pondering = false;
+
+		// node limit reached, or time limit signaled by the timer thread ?
+		const bool abort = ctx->hard_stop.load(std::memory_order_relaxed)
+			|| (ctx->can_abort && (ctx->time_up.load(std::memory_order_relaxed)
+							  || (ctx->node_limit && ctx->total_nodes() >= ctx->node_limit)));
+
+		// limit reached: abort search, unless we're pondering
+		if (abort && !ctx->pondering)
+			aborted = true;
+	}
+
+	return aborted;
+}
+
+int Worker::qsearch(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
 {
 	assert(depth <= 0 && alpha < beta);
 	const bool pv_node = alpha < beta - 1;
 
 	const Key key = B.get_key();
-	search::TT.prefetch(key);
-	node_poll();
+	if (node_poll())
+		return 0;
+
+	STAT(qnodes);
+	seldepth = std::max(seldepth, ss->ply);
 
 	const bool in_check = B.is_check();
 	int best_score = -INF, old_alpha = alpha;
@@ -154,21 +304,24 @@ int qsearch(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
 		pv[ss->ply][0] = move::move_t(0);
 
 	if (B.is_draw())
-		return DrawScore[B.get_turn()];
+		return ctx->DrawScore[B.get_turn()];
 
 	const Bitboard hanging = hanging_pieces(B);
 
 	// TT lookup
-	const TTable::Entry *tte = search::TT.probe(key);
+	const TTable::Entry *tte = ctx->TT.probe(key);
+	STAT(tt_probes);
 	if (tte) {
+		STAT(tt_hits);
 		if (can_return_tt(tte, depth, beta, ss->ply)) {
-			search::TT.refresh(tte);
+			STAT(tt_cutoffs);
+			ctx->TT.refresh(tte);
 			return score_from_tt(tte->score, ss->ply);
 		}
 		ss->eval = tte->eval;
 		ss->best = tte->move;
 	} else
-		ss->eval = in_check ? -INF : (ss->null_child ? -(ss - 1)->eval : eval::symmetric_eval(B));
+		ss->eval = in_check ? -INF : (ss->null_child ? -(ss - 1)->eval : evaluate(B));
 
 	// stand pat score
 	int stand_pat = ss->eval + eval::asymmetric_eval(B, hanging);
@@ -188,10 +341,9 @@ int qsearch(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
 	}
 
 	MoveSort MS(&B, depth, ss, &H, nullptr);
-	int see;
 	const int fut_base = stand_pat + vEP / 2;
 
-	while ( alpha < beta && (ss->m = MS.next(&see)) ) {
+	while ( alpha < beta && (ss->m = MS.next()) ) {
 		int check = move::is_check(B, ss->m);
 
 		// Futility pruning
@@ -205,28 +357,36 @@ int qsearch(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
 			// still can't raise alpha, skip
 			if (opt_score <= alpha) {
 				best_score = std::max(best_score, opt_score);	// beware of fail soft side effect
+				STAT(qs_futility);
 				continue;
 			}
 
 			// the "SEE proxy" tells us we are unlikely to raise alpha, skip if depth < 0
-			if (fut_base <= alpha && depth < 0 && see <= 0) {
+			if (fut_base <= alpha && depth < 0 && !MS.see_ge(1)) {
 				best_score = std::max(best_score, fut_base);	// beware of fail soft side effect
+				STAT(qs_futility);
 				continue;
 			}
 		}
 
 		// SEE pruning
-		if (!in_check && check != move::DISCO_CHECK && see < 0)
+		if (!in_check && check != move::DISCO_CHECK && !MS.see_ge(0)) {
+			STAT(qs_see);
 			continue;
+		}
 
 		// recursion
 		int score;
 		if (depth <= MIN_DEPTH && !in_check)		// prevent qsearch explosion
-			score = stand_pat + see;
+			score = stand_pat + MS.see();
 		else {
+			prefetch(B, ss->m);
 			B.play(ss->m);
 			score = -qsearch(B, -beta, -alpha, depth - 1, ss + 1);
 			B.undo();
+
+			if (aborted)
+				return 0;
 		}
 
 		if (score > best_score) {
@@ -252,12 +412,12 @@ int qsearch(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
 
 	// update TT
 	const int node_type = best_score <= old_alpha ? All : best_score >= beta ? Cut : PV;
-	search::TT.store(key, node_type, depth, score_to_tt(best_score, ss->ply), ss->eval, ss->best);
+	ctx->TT.store(key, node_type, depth, score_to_tt(best_score, ss->ply), ss->eval, ss->best);
 
 	return best_score;
 }
 
-void update_killers(const board::Board& B, SearchInfo *ss)
+void Worker::update_killers(const board::Board& B, SearchInfo *ss)
 {
 	// update killers on a LIFO basis
 	if (ss->killer[0] != ss->best) {
@@ -266,11 +426,11 @@ void update_killers(const board::Board& B, SearchInfo *ss)
 	}
 
 	// update double move refutation hash table
-	search::R.set_refutation(B.get_dm_key(), ss->best);
+	R.set_refutation(B.get_dm_key(), ss->best);
 }
 
 template <bool root>
-int pvs(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
+int Worker::pvs(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
 {
 	assert(alpha < beta);
 	const bool pv_node = alpha < beta - 1;
@@ -279,12 +439,15 @@ int pvs(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
 		return qsearch(B, alpha, beta, depth, ss);
 
 	const Key key = B.get_key();
-	search::TT.prefetch(key);
 
 	if (pv_node)
 		pv[ss->ply][0] = move::move_t(0);
 
-	node_poll();
+	if (node_poll())
+		return 0;
+
+	STAT(nodes);
+	seldepth = std::max(seldepth, ss->ply);
 
 	const bool in_check = B.is_check();
 	const int old_alpha = alpha;
@@ -292,7 +455,7 @@ int pvs(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
 	ss->best = move::move_t(0);
 
 	if (!root && (B.is_draw() || (bb::count_bit(B.st().occ) <= 4 && eval::is_tb_draw(B))))
-		return DrawScore[B.get_turn()];
+		return ctx->DrawScore[B.get_turn()];
 
 	// mate distance pruning
 	alpha = std::max(alpha, mated_in(ss->ply));
@@ -303,14 +466,19 @@ int pvs(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
 	const Bitboard hanging = hanging_pieces(B);
 
 	// TT lookup
-	const TTable::Entry *tte = search::TT.probe(key);
+	const TTable::Entry *tte = ctx->TT.probe(key);
+	STAT(tt_probes);
 	if (tte) {
+		STAT(tt_hits);
 		if (!pv_node && can_return_tt(tte, depth, beta, ss->ply)) {
+			STAT(tt_cutoffs);
 			// Refresh TT entry to prevent ageing
-			search::TT.refresh(tte);
+			ctx->TT.refresh(tte);
 
-			// update killers, refutation, and history on TT prune when alpha is raised
-			if (tte->score > old_alpha && (ss->best = tte->move) && !move::is_cop(B, ss->best)) {
+			// update killers, refutation, and history on TT prune when alpha is raised. Another thread
+			// may have been writing this entry while we read it, so check that the move is ours.
+			if (tte->score > old_alpha && (ss->best = tte->move)
+				&& B.get_color_on(ss->best.fsq()) == B.get_turn() && !move::is_cop(B, ss->best)) {
 				update_killers(B, ss);
 				H.add(B, ss->best, (depth * depth) >> (hanging != 0));
 			}
@@ -320,7 +488,7 @@ int pvs(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
 		ss->eval = tte->eval;
 		ss->best = tte->move;
 	} else
-		ss->eval = in_check ? -INF : (ss->null_child ? -(ss - 1)->eval : eval::symmetric_eval(B));
+		ss->eval = in_check ? -INF : (ss->null_child ? -(ss - 1)->eval : evaluate(B));
 
 	// Stand pat score: adjust for assymetric eval, and using tte->score (when possible)
 	int stand_pat = ss->eval + eval::asymmetric_eval(B, hanging);
@@ -335,16 +503,23 @@ int pvs(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
 	if (!pv_node && depth <= 5 && !ss->skip_null
 		&& !in_check && !is_mate_score(beta)
 		&& stand_pat >= beta + eval_margin(depth)
-		&& B.st().piece_psq[B.get_turn()])
+		&& B.st().piece_psq[B.get_turn()]) {
+		STAT(static_null);
 		return stand_pat;
+	}
 
 	// Razoring
 	if (!pv_node && depth <= 3 && !in_check && !is_mate_score(alpha)) {
 		const int lbound = alpha - razor_margin(depth);
 		if (stand_pat <= lbound) {
+			STAT(razor_tries);
 			const int score = qsearch(B, lbound, lbound + 1, 0, ss + 1);
-			if (score <= lbound)
+			if (aborted)
+				return 0;
+			if (score <= lbound) {
+				STAT(razor_cutoffs);
 				return score;
+			}
 		}
 	}
 
@@ -363,17 +538,23 @@ int pvs(board::Board& B, int alpha, int beta, int depth, SearchInfo *ss)
 			&& tte->score <= alpha)
 			goto tt_skip_null;
 
+		STAT(null_tries);
+		prefetch(B, move::move_t(0));
 		B.play(move::move_t(0));
 		(ss + 1)->null_child = (ss + 1)->skip_null = true;
 		const int score = -pvs<false>(B, -beta, -alpha, depth - reduction, ss + 1);
 		(ss + 1)->null_child = (ss + 1)->skip_null = false;
 		B.undo();
 
-		if (score >= beta)	// null search fails high
+		if (aborted)
+			return 0;
+
+		if (score >= beta) {	// null search fails high
+			STAT(null_cutoffs);
 			return score < mate_in(MAX_PLY)
 				? score		// fail soft
 				: beta;		// but do not return an unproven mate
-		else {
+		} else {
 			if (score <= mated_in(MAX_PLY) && (ss - 1)->reduction) {
 				++depth;
 				--(ss - 1)->reduction;
@@ -389,23 +570,36 @@ tt_skip_null:
 		ss->skip_null = true;
 		pvs<false>(B, alpha, beta, pv_node ? depth - 2 : depth / 2, ss);
 		ss->skip_null = false;
+
+		if (aborted)
+			return 0;
 	}
 
-	MoveSort MS(&B, depth, ss, &H, &search::R);
-	const move::move_t refutation = search::R.get_refutation(B.get_dm_key());
+	// At the root, search the root move list in order, minus the lines already searched (MultiPV)
+	move::move_t root_list[MAX_MOVES];
+	int root_count = 0;
+	if (root)
+		for (size_t i = pv_idx; i < root_moves.size(); ++i) {
+			root_moves[i].score = -INF;
+			root_list[root_count++] = root_moves[i].m;
+		}
+
+	MoveSort MS = root ? MoveSort(&B, root_list, root_count) : MoveSort(&B, depth, ss, &H, &R);
+	const move::move_t refutation = R.get_refutation(B.get_dm_key());
 
-	int cnt = 0, LMR = 0, see;
-	while ( alpha < beta && (ss->m = MS.next(&see)) ) {
+	int cnt = 0, LMR = 0;
+	while ( alpha < beta && (ss->m = MS.next()) ) {
 		++cnt;
 		const int check = move::is_check(B, ss->m);
 
 		// check extension
 		int new_depth;
-		if (check && (check == move::DISCO_CHECK || see >= 0) )
+		if (check && (check == move::DISCO_CHECK || MS.see_ge(0)) )
 			// extend relevant checks
 			new_depth = depth;
-		else if (MS.get_count() == 1)
-			// extend forced replies
+		else if (in_check && MS.get_count() == 1)
+			// extend forced replies (the move count is only known in check, where all evasions are
+			// generated at once)
 			new_depth = depth;
 		else
 			new_depth = depth - 1;
@@ -414,11 +608,11 @@ tt_skip_null:
 		const bool first = cnt == 1;
 		const bool capture = move::is_cop(B, ss->m);
 		const int hscore = capture ? 0 : H.get(B, ss->m);
-		const bool bad_quiet = !capture && (hscore < 0 || (hscore == 0 && see < 0));
-		const bool bad_capture = capture && see < 0;
+		const bool bad_quiet = !capture && (hscore < 0 || (hscore == 0 && !MS.see_ge(0)));
+		const bool bad_capture = capture && !MS.see_ge(0);
 		// dangerous movea are not reduced
 		const bool dangerous = check
-			|| (move::is_pawn_threat(B, ss->m) && see >= 0);
+			|| (move::is_pawn_threat(B, ss->m) && MS.see_ge(0));
 
 		// basic reduction (1 ply)
 		ss->reduction = !first && (bad_capture || bad_quiet)
@@ -443,7 +637,8 @@ tt_skip_null:
 			if (child_depth <= 5) {
 				const int opt_score = stand_pat + vEP/2 + eval_margin(child_depth);
 				if (opt_score <= alpha) {
-					best_score = std::max(best_score, std::min(alpha, stand_pat + see));
+					best_score = std::max(best_score, std::min(alpha, stand_pat + MS.see()));
+					STAT(futility);
 					continue;
 				}
 			}
@@ -451,17 +646,21 @@ tt_skip_null:
 			// Move count pruning
 			if ( LMR >= 3 + depth * (2 * depth - 1) / 2
 				 && alpha > mated_in(MAX_PLY) ) {
-				best_score = std::max(best_score, std::min(alpha, stand_pat + see));
+				best_score = std::max(best_score, std::min(alpha, stand_pat + MS.see()));
+				STAT(move_count);
 				continue;
 			}
 
 			// SEE pruning near the leaves
-			if (new_depth <= 1 && see < 0) {
-				best_score = std::max(best_score, std::min(alpha, stand_pat + see));
+			if (new_depth <= 1 && !MS.see_ge(0)) {
+				best_score = std::max(best_score, std::min(alpha, stand_pat + MS.see()));
+				STAT(see);
 				continue;
 			}
 		}
 
+		prefetch(B, ss->m);
+		const uint64_t nodes_before = node_count.load(std::memory_order_relaxed);
 		B.play(ss->m);
 
 		// PVS
@@ -472,11 +671,15 @@ tt_skip_null:
 			score = -pvs<false>(B, -beta, -alpha, new_depth, ss + 1);
 		else {
 			// zero window search (reduced)
+			if (ss->reduction)
+				STAT(reduced);
 			score = -pvs<false>(B, -alpha - 1, -alpha, new_depth - ss->reduction, ss + 1);
 
 			// doesn't fail low: verify at full depth, with zero window
-			if (score > alpha && ss->reduction)
+			if (score > alpha && ss->reduction) {
+				STAT(researched);
 				score = -pvs<false>(B, -alpha - 1, -alpha, new_depth, ss + 1);
+			}
 
 			// still doesn't fail low at PV node: full depth and full window
 			if (pv_node && score > alpha)
@@ -485,6 +688,22 @@ tt_skip_null:
 
 		B.undo();
 
+		if (aborted)
+			return 0;
+
+		if (root) {
+			RootMove& rm = *std::find_if(root_moves.begin() + pv_idx, root_moves.end(),
+				[&](const RootMove& r) { return r.m == ss->m; });
+			rm.nodes += node_count.load(std::memory_order_relaxed) - nodes_before;
+
+			if (first || score > alpha) {
+				rm.score = score;
+				rm.pv[0] = ss->m;
+				memcpy(&rm.pv[1], &pv[ss->ply+1][0], MAX_PLY * sizeof(move::move_t));
+				rm.pv[MAX_PLY] = move::move_t(0);
+			}
+		}
+
 		if (score > best_score) {
 			best_score = score;
 			ss->best = ss->m;
@@ -500,7 +719,7 @@ tt_skip_null:
 				}
 			}
 
-			if (root) {
+			if (root && !pv_idx) {
 				if (best_move != ss->m) {
 					best_move_changed = true;
 					best_move = ss->m;
@@ -513,14 +732,22 @@ tt_skip_null:
 	if (!MS.get_count()) {
 		// mated or stalemated
 		assert(!root);
-		return in_check ? mated_in(ss->ply) : DrawScore[B.get_turn()];
-	} else if (root && MS.get_count() == 1 && can_abort && !pondering)
+		return in_check ? mated_in(ss->ply) : ctx->DrawScore[B.get_turn()];
+	} else if (root && forced_move && !id && ctx->can_abort && !ctx->pondering) {
 		// forced move at the root node, play instantly and prevent further iterative deepening
-		throw ForcedMove();
+		aborted = true;
+		return best_score;
+	}
+
+	if (best_score >= beta) {
+		STAT(fail_highs);
+		if (cnt == 1)
+			STAT(first_move_fail_highs);
+	}
 
 	// update TT
 	const int node_type = best_score <= old_alpha ? All : best_score >= beta ? Cut : PV;
-	search::TT.store(key, node_type, depth, score_to_tt(best_score, ss->ply), ss->eval, ss->best);
+	ctx->TT.store(key, node_type, depth, score_to_tt(best_score, ss->ply), ss->eval, ss->best);
 
 	// best move is quiet: update move sorting heuristics if alpha was raised
 	if (best_score > old_alpha && ss->best && !move::is_cop(B, ss->best)) {
@@ -540,114 +767,320 @@ tt_skip_null:
 	return best_score;
 }
 
-}	// namespace
-
-namespace search {
-
-std::pair<move::move_t, move::move_t> bestmove(board::Board& B, const Limits& sl)
-// returns a pair (best move, ponder move)
+void Worker::init_search(const board::Board& root, const std::vector<move::move_t>& searchmoves)
 {
-	start = high_resolution_clock::now();
-
-	SearchInfo ss[MAX_PLY + 1];
+	pos = root;
 	for (int ply = 0; ply <= MAX_PLY; ++ply)
-		ss[ply].clear(ply);
+		stack[ply].clear(ply);
 
 	node_count = 0;
-	node_limit = sl.nodes;
-	pondering = sl.ponder;
-	time_alloc(sl, time_limit);
-
+	seldepth = 0;
+	stats.clear();
+	aborted = false;
 	best_move = ponder_move = move::move_t(0);
 	best_move_changed = false;
-
+	result = Result();
 	H.clear();
-	TT.new_search();
-	B.set_root();	// remember root node, for correct 2/3-fold in is_draw()
 
-	// Contempt Draw value
-	const int us = B.get_turn(), them = opp_color(us);
-	DrawScore[us] = -uci::Contempt;
-	DrawScore[them] = uci::Contempt;
-
-	uci::info ui;
-	ui.pv = pv[0];
-
-	const int max_depth = sl.depth ? std::min(MAX_DEPTH, sl.depth) : MAX_DEPTH;
-
-	// iterative deepening loop
-	for (int depth = 1, alpha = -INF, beta = +INF; depth <= max_depth; depth++) {
-		ui.clear();
-		ui.depth = depth;
+	if (EC.size() != (size_t)uci::EvalCache)
+		EC.resize(uci::EvalCache);
+	if (PC.size() != (size_t)uci::PawnCache)
+		PC.resize(uci::PawnCache);
+
+	// Root move list: legal moves, restricted to searchmoves (unless none of them is legal). Initial
+	// order is the one of MoveSort, with the TT move first.
+	const TTable::Entry *tte = ctx->TT.probe(pos.get_key());
+	stack[0].best = tte ? tte->move : move::move_t(0);
+	MoveSort MS(&pos, 1, stack, &H, &R);
+	stack[0].best = move::move_t(0);
+
+	root_moves.clear();
+	std::vector<RootMove> all_moves;
+	move::move_t m;
+	while ( (m = MS.next()) ) {
+		RootMove rm;
+		rm.m = m;
+		rm.score = rm.prev_score = -INF;
+		rm.nodes = 0;
+		rm.pv[0] = m;
+		rm.pv[1] = move::move_t(0);
+
+		all_moves.push_back(rm);
+		if (std::find(searchmoves.begin(), searchmoves.end(), m) != searchmoves.end())
+			root_moves.push_back(rm);
+	}
 
-		// We can only abort the search once iteration 1 is finished. In extreme situations (eg.
-		// fixed nodes), the SearchLimits sl could trigger a search abortion before that, which is
-		// disastrous, as the best move could be illegal or completely stupid.
-		can_abort = depth >= 2;
+	if (root_moves.empty())
+		root_moves.swap(all_moves);
+	forced_move = MS.get_count() == 1;
+}
 
-		int delta = 16;
+void Worker::iterate(int max_depth)
+{
+	const bool main = !id;
+	// helpers only search the best line: they are here to fill the TT
+	const size_t multipv = main ? std::min<size_t>(std::max(uci::MultiPV, 1), root_moves.size()) : 1;
+	uci::info ui;
 
-		// Time allowance
-		time_allowed = time_limit[best_move_changed];
-		if (best_move && move::see(B, best_move) > 0)
-			time_allowed /= 2;
+	// mated or stalemated
+	if (root_moves.empty())
+		return;
+
+	// iterative deepening loop. Odd helpers start one ply deeper, so that all threads are not
+	// searching the same depth at the same time.
+	for (int depth = 1 + (id & 1); depth <= max_depth; depth++) {
+		if (main) {
+			// We can only abort the search once iteration 1 is finished. In extreme situations (eg.
+			// fixed nodes), the SearchLimits sl could trigger a search abortion before that, which is
+			// disastrous, as the best move could be illegal or completely stupid.
+			ctx->can_abort = depth >= 2;
+
+			// Time allowance
+			int allowed = ctx->time_limit[best_move_changed];
+			if (best_move && move::see_ge(pos, best_move, 1))
+				allowed /= 2;
+			ctx->set_time_allowed(allowed);
+		}
 
 		best_move_changed = false;
-		for (;;) {
-			// Aspiration loop
-
-			try {
-				ui.score = pvs<true>(B, alpha, beta, depth, ss);
-			} catch (AbortSearch e) {
-				goto return_pair;
-			} catch (ForcedMove e) {
-				best_move = ss->best;
-				goto return_pair;
+		for (auto& rm : root_moves)
+			rm.prev_score = rm.score;
+
+		for (pv_idx = 0; pv_idx < multipv; ++pv_idx) {
+			// aspiration window around the score of this line at the previous iteration (so aspiration
+			// starts at depth 5)
+			const int prev_score = root_moves[pv_idx].prev_score;
+			int alpha = -INF, beta = +INF, delta = 16;
+			if (depth >= 5 && prev_score > -INF && !is_mate_score(prev_score)) {
+				alpha = prev_score - delta;
+				beta = prev_score + delta;
 			}
 
-			ui.nodes = node_count;
-			ui.time = duration_cast<milliseconds>(high_resolution_clock::now() - start).count();
+			for (;;) {
+				// Aspiration loop
 
-			if (alpha < ui.score && ui.score < beta) {
-				// score is within bounds
-				ui.bound = uci::info::EXACT;
+				const int score = pvs<true>(pos, alpha, beta, depth, stack);
+				if (aborted)
+					return;
+
+				// best lines first. Moves that failed low all score -INF: the ones with the biggest
+				// subtrees come first, as they were the hardest to refute.
+				std::stable_sort(root_moves.begin() + pv_idx, root_moves.end());
+
+				if (alpha < score && score < beta)
+					// score is within bounds: stop the aspiration loop
+					break;
 
-				// set aspiration window for the next depth (so aspiration starts at depth 5)
-				if (depth >= 4 && !is_mate_score(ui.score)) {
-					alpha = ui.score - delta;
-					beta = ui.score + delta;
-				}
-				// stop the aspiration loop
-				break;
-			} else {
 				// score is outside bounds: resize window and double delta
-				if (ui.score <= alpha) {
+				ui.clear();
+				if (score <= alpha) {
 					alpha -= delta;
 					ui.bound = uci::info::UBOUND;
-					std::cout << ui << std::endl;
-				} else if (ui.score >= beta) {
+				} else if (score >= beta) {
 					beta += delta;
 					ui.bound = uci::info::LBOUND;
-					std::cout << ui << std::endl;
 				}
 				delta *= 2;
 
-				// increase time_allowed, to try to finish the current depth iteration
-				time_allowed = time_limit[1];
+				if (main) {
+					// increase time_allowed, to try to finish the current depth iteration
+					ctx->set_time_allowed(ctx->time_limit[1]);
+
+					if (ctx->uci_output) {
+						ui.score = score;
+						ui.depth = depth;
+						ui.multipv = multipv > 1 ? pv_idx + 1 : 0;
+						ui.seldepth = seldepth;
+						ui.nodes = ctx->total_nodes();
+						ui.time = ctx->elapsed_msec();
+						std::lock_guard<std::mutex> lock(uci::output_mtx);
+						std::cout << ui << std::endl;
+					}
+				}
 			}
+
+			// lines are searched with different windows: sort those that are finished
+			std::stable_sort(root_moves.begin(), root_moves.begin() + pv_idx + 1);
 		}
 
-		std::cout << ui << std::endl;
+		// play the best of all lines. Note that best_move is also updated during the search of the
+		// first line, so that the result of an unfinished iteration is used.
+		if (best_move != root_moves[0].m) {
+			best_move_changed = true;
+			best_move = root_moves[0].m;
+		}
+		ponder_move = root_moves[0].pv[1];
+
+		if (main) {
+			result.depth = depth;
+			result.score = root_moves[0].score;
+			result.pv.clear();
+			for (int i = 0; i <= MAX_PLY && root_moves[0].pv[i]; ++i)
+				result.pv.push_back(root_moves[0].pv[i]);
+		}
+
+		if (main && ctx->uci_output) {
+			ui.clear();
+			ui.depth = depth;
+			ui.seldepth = seldepth;
+			ui.nodes = ctx->total_nodes();
+			ui.time = ctx->elapsed_msec();
+			ui.hashfull = ctx->TT.hashfull();
+
+			std::lock_guard<std::mutex> lock(uci::output_mtx);
+			for (size_t i = 0; i < multipv; ++i) {
+				ui.multipv = multipv > 1 ? i + 1 : 0;
+				ui.score = root_moves[i].score;
+				ui.pv = root_moves[i].pv;
+				std::cout << ui << std::endl;
+			}
+		}
 	}
+}
+
+Result Context::bestmove(board::Board& B, const Limits& sl)
+{
+	start = high_resolution_clock::now();
+	TT.wait();	// may still be cleared in the background (on the clock, as it should)
+
+	node_limit = sl.nodes;
+	pondering = sl.ponder;
+	time_alloc(sl, time_limit);
+
+	TT.new_search();
+	B.set_root();	// remember root node, for correct 2/3-fold in is_draw()
+
+	// Contempt Draw value
+	const int us = B.get_turn(), them = opp_color(us);
+	DrawScore[us] = -uci::Contempt;
+	DrawScore[them] = uci::Contempt;
+
+	// one worker per thread, kept alive between searches (to keep their refutation tables)
+	const size_t threads = std::max(uci::Threads, 1);
+	if (workers.size() > threads)
+		workers.resize(threads);
+	while (workers.size() < threads)
+		workers.emplace_back(new Worker(this, workers.size()));
+
+	for (auto& w : workers)
+		w->init_search(B, sl.searchmoves);
+
+	const int max_depth = sl.depth ? std::min(MAX_DEPTH, sl.depth) : MAX_DEPTH;
 
-return_pair:
-	return std::make_pair(best_move, ponder_move);
+	// start the timer
+	time_allowed = time_limit[0];
+	time_up = hard_stop = timer_done = false;
+	std::thread timer;
+	if (time_limit[1])
+		timer = std::thread(&Context::timer_loop, this);
+
+	// start the helpers, and search with the main thread
+	stop = false;
+	std::vector<std::thread> helpers;
+	for (size_t i = 1; i < workers.size(); ++i)
+		helpers.emplace_back(&Worker::iterate, workers[i].get(), max_depth);
+
+	Worker& main = *workers[0];
+	main.iterate(max_depth);
+
+	stop = true;
+	for (auto& t : helpers)
+		t.join();
+
+	if (timer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(timer_mtx);
+			timer_done = true;
+		}
+		timer_cv.notify_one();
+		timer.join();
+	}
+
+	// The watchdog can abort iteration 1 before any root move has been searched. In that case
+	// play the first root move, rather than nothing.
+	if (!main.best_move && !main.root_moves.empty())
+		main.best_move = main.root_moves[0].m;
+
+	Result r = main.result;
+	r.best = main.best_move;
+	r.ponder = main.ponder_move;
+	r.nodes = total_nodes();
+
+	// unfinished iteration with a new best move: the PV of the last iteration does not apply
+	if (!r.best)
+		r.pv.clear();
+	else if (r.pv.empty() || r.pv[0] != r.best) {
+		r.pv.assign(1, r.best);
+		if (r.ponder)
+			r.pv.push_back(r.ponder);
+	}
+
+	if (Stats::Enabled && uci_output)
+		std::cout << stats() << std::endl;
+
+	return r;
+}
+
+void Context::cache_stats(eval::CacheStats& ec, eval::CacheStats& pc) const
+{
+	ec = pc = eval::CacheStats();
+	for (auto& w : workers) {
+		ec += w->EC.stats;
+		pc += w->PC.stats;
+	}
 }
 
-void clear_state()
+Stats Context::stats() const
 {
-	TT.clear();
-	R.clear();
+	Stats s;
+	for (auto& w : workers)
+		s += w->stats;
+	return s;
+}
+
+Stats& Stats::operator+= (const Stats& s)
+{
+	// all members are counters
+	const uint64_t *src = (const uint64_t *)&s;
+	uint64_t *dst = (uint64_t *)this;
+	for (size_t i = 0; i < sizeof(Stats) / sizeof(uint64_t); ++i)
+		dst[i] += src[i];
+	return *this;
+}
+
+std::ostream& operator<< (std::ostream& os, const Stats& s)
+{
+	auto pct = [](uint64_t n, uint64_t total) {
+		std::ostringstream o;
+		o << std::fixed << std::setprecision(1) << (total ? 100.0 * n / total : 0.0) << '%';
+		return o.str();
+	};
+
+	os << "info string nodes " << s.nodes << " qnodes " << s.qnodes << " (qsearch "
+		<< pct(s.qnodes, s.nodes + s.qnodes) << ")\n";
+	os << "info string tt probes " << s.tt_probes << " hits " << pct(s.tt_hits, s.tt_probes)
+		<< " cutoffs " << pct(s.tt_cutoffs, s.tt_probes) << '\n';
+	os << "info string fail highs " << s.fail_highs << " first move "
+		<< pct(s.first_move_fail_highs, s.fail_highs) << '\n';
+	os << "info string null move " << s.null_tries << " cutoffs " << pct(s.null_cutoffs, s.null_tries)
+		<< " razoring " << s.razor_tries << " cutoffs " << pct(s.razor_cutoffs, s.razor_tries) << '\n';
+	os << "info string lmr " << s.reduced << " researched " << pct(s.researched, s.reduced) << '\n';
+	os << "info string pruned static null " << s.static_null << " futility " << s.futility
+		<< " move count " << s.move_count << " see " << s.see << " qsearch futility " << s.qs_futility
+		<< " qsearch see " << s.qs_see;
+
+	return os;
+}
+
+void Context::clear(bool background)
+{
+	TT.clear(background);
+	for (auto& w : workers) {
+		w->R.clear();
+		w->EC.clear();
+		w->PC.clear();
+		w->MC.clear();
+	}
 }
 
 }	// namespace search
@@ -13,6 +13,14 @@
  * see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "eval.h"
 #include "movesort.h"
 #include "tt.h"
 
@@ -23,14 +31,97 @@ struct Limits {
 	int time, inc, movetime, depth, movestogo;
 	uint64_t nodes;
 	bool ponder;
+	std::vector<move::move_t> searchmoves;	// restrict the root to these moves (if not empty)
 };
 
-extern TTable TT;
+// Result of a search. score, depth and pv are those of the last completed iteration.
+struct Result {
+	Result(): best(0), ponder(0), score(0), depth(0), nodes(0) {}
+	move::move_t best, ponder;
+	int score, depth;
+	uint64_t nodes;
+	std::vector<move::move_t> pv;
+};
+
+/* Search statistics of each thread, summed by Context::stats(). They are only counted when compiled
+ * with -DSTATS: otherwise the counting code is compiled out, and all counters stay at zero. */
+struct Stats {
+#ifdef STATS
+	static const bool Enabled = true;
+#else
+	static const bool Enabled = false;
+#endif
+
+	Stats() { clear(); }
+	void clear() { std::memset(this, 0, sizeof(*this)); }
+	Stats& operator+= (const Stats& s);
+
+	uint64_t nodes, qnodes;	// pvs() nodes (excluding the qsearch), and qsearch() nodes
+	uint64_t tt_probes, tt_hits, tt_cutoffs;
+	uint64_t fail_highs, first_move_fail_highs;
+	uint64_t null_tries, null_cutoffs;
+	uint64_t razor_tries, razor_cutoffs;
+	uint64_t reduced, researched;	// LMR: moves searched with a reduction, and searched again
+	uint64_t static_null, futility, move_count, see;	// pruned nodes, and moves
+	uint64_t qs_futility, qs_see;	// qsearch pruned moves
+};
+
+// "info string" lines, with rates
+extern std::ostream& operator<< (std::ostream& os, const Stats& s);
+
+class Worker;
+
+/* Search context: owns the TT, the search threads, and the state of the current search. The UCI
+ * engine uses search::engine, but independent searches can run concurrently, each in its own
+ * Context (eg. batch analysis). */
+class Context {
+public:
+	Context();
+	~Context();
 
-extern uint64_t node_count;
+	Result bestmove(board::Board& B, const Limits& sl);
+	void clear(bool background = false);	// TT, eval caches, and move sorting heuristics
+	void cache_stats(eval::CacheStats& ec, eval::CacheStats& pc) const;	// all threads, since created
+	Stats stats() const;	// all threads, last search
+
+	TTable TT;
+	bool uci_output;	// print info lines
+
+private:
+	friend class Worker;
+
+	bool can_abort, pondering;	// only used by the main thread
+	int DrawScore[NB_COLOR];	// Contempt draw score by color
+
+	uint64_t node_limit;
+	int time_limit[2];
+	std::chrono::time_point<std::chrono::high_resolution_clock> start;
+
+	// Set by the main thread when it has finished searching, to stop the helper threads
+	std::atomic<bool> stop;
+
+	/* Timer thread: owns the clock during a timed search, so that the search never reads it.
+	 * - time_up is raised at the soft deadline (time_allowed, adjusted by the main thread at each
+	 *   iteration), and aborts the search once iteration 1 is finished.
+	 * - hard_stop is raised at the hard deadline, and acts as a watchdog: it aborts the search even
+	 *   if iteration 1 is not finished, rather than losing on time. */
+	int time_allowed;			// protected by timer_mtx
+	bool timer_done;			// protected by timer_mtx
+	std::mutex timer_mtx;
+	std::condition_variable timer_cv;
+	std::atomic<bool> time_up, hard_stop;
+
+	std::vector<std::unique_ptr<Worker>> workers;
+
+	int elapsed_msec() const;
+	void set_time_allowed(int msec);
+	void timer_loop();
+	uint64_t total_nodes() const;
+};
 
-std::pair<move::move_t, move::move_t> bestmove(board::Board& B, const Limits& sl);
+extern Context engine;
 
-extern void clear_state();
+// Raised asynchronously by the UCI input thread
+extern std::atomic<bool> stop_signal, ponderhit_signal;
 
 }	// namespace search
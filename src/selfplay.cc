@@ -0,0 +1,341 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+*/
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "selfplay.h"
+#include "movegen.h"
+#include "prng.h"
+#include "search.h"
+#include "uci.h"
+
+using namespace std::chrono;
+
+namespace {
+
+const char *StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+const int MaxPlies = 400;		// adjudicated as a draw after that
+const int ResignScore = 1000;	// adjudicated as a win when both sides agree on such a score,
+const int ResignPlies = 4;		// for that many plies in a row
+const size_t ChunkSize = 4096;	// positions written at once by a job (128 KB)
+
+// Output file, shared by all jobs
+FILE *output;
+std::mutex output_mtx;
+uint64_t position_count, total_nodes;
+int game_results[3];	// losses, draws, wins (for White)
+
+std::atomic<int> next_game;
+
+int play_game(search::Context& ctx, PRNG& prng, const search::Limits& sl, int random_plies,
+	std::vector<selfplay::PackedPosition>& out, uint64_t& nodes)
+/* Plays a game, and appends its positions to out: positions in check, and those where the best move
+ * is a capture or a promotion, are skipped (their static eval is meaningless). Returns the result for
+ * White (1, 0, -1), and adds the nodes searched to nodes. */
+{
+	board::Board B;
+	move::move_t mlist[MAX_MOVES];
+	int n;
+
+	// random opening, played again if it ends the game
+	do {
+		B.set_fen(StartFEN);
+		for (int ply = 0; ply < random_plies && (n = movegen::gen_moves(B, mlist) - mlist); ++ply)
+			B.play(mlist[prng.rand() % n]);
+	} while (movegen::gen_moves(B, mlist) == mlist || B.is_draw());
+
+	ctx.clear();
+	const size_t first = out.size();
+	int result = 0, resign = 0;
+
+	for (int ply = 0; ; ++ply) {
+		if (movegen::gen_moves(B, mlist) == mlist) {
+			// mate or stalemate
+			result = B.is_check() ? (B.get_turn() == WHITE ? -1 : 1) : 0;
+			break;
+		}
+		if (B.is_draw() || ply >= MaxPlies)
+			break;
+
+		const search::Result r = ctx.bestmove(B, sl);
+		nodes += r.nodes;
+		const int white_score = B.get_turn() == WHITE ? r.score : -r.score;
+
+		if (std::abs(r.score) >= MATE - MAX_PLY) {
+			result = white_score > 0 ? 1 : -1;
+			break;
+		}
+
+		resign = white_score >= ResignScore ? std::max(resign, 0) + 1
+			: white_score <= -ResignScore ? std::min(resign, 0) - 1 : 0;
+		if (std::abs(resign) >= ResignPlies) {
+			result = resign > 0 ? 1 : -1;
+			break;
+		}
+
+		if (!B.is_check() && !move::is_cop(B, r.best)) {
+			out.emplace_back();
+			selfplay::pack(B, r.score, r.best, out.back());
+		}
+
+		B.play(r.best);
+	}
+
+	for (size_t i = first; i < out.size(); ++i)
+		out[i].result = (out[i].turn_crights >> 4) == WHITE ? result : -result;
+
+	return result;
+}
+
+void flush(std::vector<selfplay::PackedPosition>& buf)
+{
+	std::lock_guard<std::mutex> lock(output_mtx);
+	fwrite(buf.data(), sizeof(selfplay::PackedPosition), buf.size(), output);
+	position_count += buf.size();
+	buf.clear();
+}
+
+void job(const search::Limits& sl, int games, int random_plies, int hash, uint64_t seed)
+/* Each job has its own search context, and buffers its positions, so that jobs only synchronize to
+ * write a chunk. The PRNG is seeded, and the TT cleared, before each game, so that game g only depends
+ * on seed + g, whichever job plays it (but the order of the games in the file does not). */
+{
+	search::Context ctx;
+	ctx.uci_output = false;
+	ctx.TT.alloc((uint64_t)hash << 20);
+
+	PRNG prng;
+
+	std::vector<selfplay::PackedPosition> buf;
+	buf.reserve(ChunkSize + 2 * MaxPlies);
+
+	for (int g; (g = next_game++) < games; ) {
+		uint64_t nodes = 0;
+		prng.init(seed + g);
+		const int result = play_game(ctx, prng, sl, random_plies, buf, nodes);
+		if (buf.size() >= ChunkSize)
+			flush(buf);
+
+		std::lock_guard<std::mutex> lock(output_mtx);
+		++game_results[result + 1];
+		total_nodes += nodes;
+		if ((g + 1) % 100 == 0)
+			std::cerr << "games = " << g + 1 << ", positions = " << position_count << std::endl;
+	}
+
+	flush(buf);
+}
+
+void unpack_squares(const selfplay::PackedPosition& p, int color_on[NB_SQUARE], int piece_on[NB_SQUARE])
+{
+	std::fill(piece_on, piece_on + NB_SQUARE, NO_PIECE);
+
+	Bitboard b = p.occ;
+	for (int i = 0; b; ++i) {
+		const int sq = bb::pop_lsb(&b), code = p.pieces[i / 2] >> (4 * (i & 1)) & 15;
+		color_on[sq] = code >> 3;
+		piece_on[sq] = code & 7;
+	}
+}
+
+}	// namespace
+
+namespace selfplay {
+
+void pack(const board::Board& B, int score, move::move_t best, PackedPosition& p)
+{
+	p = PackedPosition();
+	p.occ = B.get_pieces(WHITE) | B.get_pieces(BLACK);
+
+	Bitboard b = p.occ;
+	for (int i = 0; b; ++i) {
+		assert(i < 32);
+		const int sq = bb::pop_lsb(&b);
+		p.pieces[i / 2] |= (B.get_color_on(sq) << 3 | B.get_piece_on(sq)) << (4 * (i & 1));
+	}
+
+	p.turn_crights = B.get_turn() << 4 | B.st().crights;
+	p.epsq = B.st().epsq;
+	p.rule50 = std::min(B.st().rule50, 255);
+	p.score = score;
+	p.best = best;
+}
+
+void unpack(const PackedPosition& p, board::Board& B)
+{
+	int color_on[NB_SQUARE], piece_on[NB_SQUARE];
+	unpack_squares(p, color_on, piece_on);
+	B.set_pos(color_on, piece_on, p.turn_crights >> 4, p.turn_crights & 15, p.epsq, p.rule50);
+}
+
+std::string unpack(const PackedPosition& p)
+{
+	int color_on[NB_SQUARE], piece_on[NB_SQUARE];
+	unpack_squares(p, color_on, piece_on);
+
+	std::string fen;
+	fen.reserve(96);
+
+	for (int r = RANK_8; r >= RANK_1; --r) {
+		int empty_cnt = 0;
+		for (int f = FILE_A; f <= FILE_H; ++f) {
+			const int sq = square(r, f);
+			if (piece_on[sq] == NO_PIECE)
+				++empty_cnt;
+			else {
+				if (empty_cnt) {
+					fen += char('0' + empty_cnt);
+					empty_cnt = 0;
+				}
+				fen += board::PieceLabel[color_on[sq]][piece_on[sq]];
+			}
+		}
+		if (empty_cnt)
+			fen += char('0' + empty_cnt);
+		if (r > RANK_1)
+			fen += '/';
+	}
+
+	fen += (p.turn_crights >> 4) == WHITE ? " w " : " b ";
+
+	const int crights = p.turn_crights & 15;
+	if (crights) {
+		if (crights & board::OO)
+			fen += 'K';
+		if (crights & board::OOO)
+			fen += 'Q';
+		if (crights & (board::OO << 2))
+			fen += 'k';
+		if (crights & (board::OOO << 2))
+			fen += 'q';
+	} else
+		fen += '-';
+
+	fen += ' ';
+	if (p.epsq < NO_SQUARE) {
+		fen += char(file(p.epsq) + 'a');
+		fen += char(rank(p.epsq) + '1');
+	} else
+		fen += '-';
+
+	fen += ' ' + std::to_string(p.rule50) + " 1";
+
+	return fen;
+}
+
+}	// namespace selfplay
+
+void selfplay_games(int argc, char **argv)
+{
+	if (argc < 3) {
+		std::cerr << "usage: " << argv[0] << " selfplay <file.bin> [--games n] [--nodes n]"
+			" [--random n] [--jobs n] [--hash mb] [--seed s]" << std::endl;
+		return;
+	}
+
+	search::Limits sl;
+	sl.nodes = 5000;
+	int games = 100, random_plies = 8, hash = 16;
+	int jobs = std::max<int>(std::thread::hardware_concurrency(), 1);
+	uint64_t seed = duration_cast<microseconds>(high_resolution_clock::now().time_since_epoch()).count();
+
+	for (int i = 3; i + 1 < argc; i += 2) {
+		const std::string option(argv[i]);
+		if (option == "--games")
+			games = std::atoi(argv[i + 1]);
+		else if (option == "--nodes")
+			sl.nodes = std::max<uint64_t>(std::strtoull(argv[i + 1], nullptr, 10), 1);
+		else if (option == "--random")
+			random_plies = std::max(std::atoi(argv[i + 1]), 0);
+		else if (option == "--jobs")
+			jobs = std::max(std::atoi(argv[i + 1]), 1);
+		else if (option == "--hash")
+			hash = std::max(std::atoi(argv[i + 1]), 1);
+		else if (option == "--seed")
+			seed = std::strtoull(argv[i + 1], nullptr, 10);
+	}
+
+	output = fopen(argv[2], "wb");
+	if (!output) {
+		std::cerr << "cannot open " << argv[2] << std::endl;
+		return;
+	}
+
+	// each job searches with one thread, and scores are objective
+	uci::Threads = 1;
+	uci::MultiPV = 1;
+	uci::Contempt = 0;
+
+	std::cerr << "seed = " << seed << std::endl;
+	const auto start = high_resolution_clock::now();
+
+	std::vector<std::thread> pool;
+	for (int i = 0; i < jobs; ++i)
+		pool.emplace_back(job, sl, games, random_plies, hash, seed);
+	for (auto& t : pool)
+		t.join();
+
+	fclose(output);
+
+	const int64_t elapsed_usec = std::max<int64_t>(duration_cast<microseconds>(
+		high_resolution_clock::now() - start).count(), 1);
+	std::cerr << "games = " << games << " (+" << game_results[2] << " =" << game_results[1]
+		<< " -" << game_results[0] << ")" << std::endl;
+	std::cerr << "positions = " << position_count << std::endl;
+	std::cerr << "time (ms) = " << elapsed_usec / 1000 << std::endl;
+	std::cerr << "positions/s = " << (uint64_t)(position_count / (double)elapsed_usec * 1e6) << std::endl;
+	std::cerr << "kn/s = " << total_nodes / (double)elapsed_usec * 1e3 << std::endl;
+}
+
+void unpack_games(int argc, char **argv)
+{
+	if (argc < 3) {
+		std::cerr << "usage: " << argv[0] << " unpack <file.bin>" << std::endl;
+		return;
+	}
+
+	FILE *f = fopen(argv[2], "rb");
+	if (!f) {
+		std::cerr << "cannot open " << argv[2] << std::endl;
+		return;
+	}
+
+	std::vector<selfplay::PackedPosition> buf(ChunkSize);
+	size_t n;
+
+	while ((n = fread(buf.data(), sizeof(selfplay::PackedPosition), buf.size(), f)) > 0)
+		for (size_t i = 0; i < n; ++i) {
+			const selfplay::PackedPosition& p = buf[i];
+			const int result = (p.turn_crights >> 4) == WHITE ? p.result : -p.result;
+
+			// the 4 FEN fields of the position
+			std::istringstream is(selfplay::unpack(p));
+			std::string field;
+			for (int k = 0; k < 4 && is >> field; ++k)
+				std::cout << field << ' ';
+
+			std::cout << "c9 \"" << (result > 0 ? "1-0" : result < 0 ? "0-1" : "1/2-1/2") << "\"; ce "
+				<< p.score << "; bm " << move::move_to_string(p.best) << ";\n";
+		}
+
+	fclose(f);
+}
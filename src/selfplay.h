@@ -0,0 +1,52 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <string>
+#include "board.h"
+
+namespace selfplay {
+
+/* A position of a self-play game, with its search score, best move, and the game result. Pieces are
+ * listed in the order of the occupied squares (A1 first), as 4-bit codes: color << 3 | piece. Files
+ * are arrays of PackedPosition, in the native (little endian) byte order. */
+struct PackedPosition {
+	Bitboard occ;
+	uint8_t pieces[16];
+	uint8_t turn_crights;	// turn << 4 | crights
+	uint8_t epsq;			// NO_SQUARE if none
+	uint8_t rule50;
+	int8_t result;			// for the side to move: 1 (win), 0 (draw), -1 (loss)
+	int16_t score;			// for the side to move
+	move::move_t best;
+};
+
+static_assert(sizeof(PackedPosition) == 32, "PackedPosition must be 32 bytes");
+
+extern void pack(const board::Board& B, int score, move::move_t best, PackedPosition& p);
+extern std::string unpack(const PackedPosition& p);	// FEN of the position
+extern void unpack(const PackedPosition& p, board::Board& B);	// without a FEN string (tuner)
+
+}	// namespace selfplay
+
+/* Self-play games at a fixed number of nodes per move, from the command line:
+ * discocheck selfplay <file.bin> [--games n] [--nodes n] [--random n] [--jobs n] [--hash mb] [--seed s]
+ * Games start with n random plies. Jobs play games concurrently, and append their positions to the
+ * file by chunks. */
+extern void selfplay_games(int argc, char **argv);
+
+/* Converts a self-play file to EPD, with the result (from White's point of view), score and best move
+ * of each position, eg. '<fen> c9 "1-0"; ce 35; bm e2e4;':
+ * discocheck unpack <file.bin> */
+extern void unpack_games(int argc, char **argv);
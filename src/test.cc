@@ -1,78 +1,47 @@
 #include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <vector>
 #include "search.h"
+#include "uci.h"
+#include "eval.h"
+#include "nnue.h"
+#include "book.h"
 
 using namespace std::chrono;
 
-uint64_t perft(board::Board& B, int depth, int ply)
-/* Calculates perft(depth), and displays all perft(depth-1) in the initial position. This
- * decomposition is useful to debug an incorrect perft recursively, against a correct perft
- * generator */
-{
-	move::move_t mlist[MAX_MOVES];
-	move::move_t *begin = mlist, *m;
-	move::move_t *end = movegen::gen_moves(B, mlist);
-	uint64_t count;
-
-	if (depth > 1) {
-		for (m = begin, count = 0ULL; m < end; m++) {
-			uint64_t count_subtree;
-
-			B.play(*m);
-			count += count_subtree = perft(B, depth - 1, ply + 1);
-			B.undo();
-
-			if (!ply)
-				std::cout << move_to_string(*m) << '\t' << count_subtree << std::endl;
-		}
-	} else {
-		count = end - begin;
-		if (!ply)
-			for (m = begin; m < end; m++)
-				std::cout << move_to_string(*m) << std::endl;
-	}
-
-	return count;
-}
-
-bool test_perft()
-{
-	board::Board B;
-
-	struct TestPerft {
-		const char *s;
-		int depth;
-		uint64_t value;
-	};
-
-	// http://chessprogramming.wikispaces.com/Perft+Results
-	TestPerft Test[] = {
-		{"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 6, 119060324ull},
-		{"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -", 5, 193690690ull},
-		{"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -", 7, 178633661ull},
-		{"r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 6, 706045033ull},
-		{"rnbqkb1r/pp1p1ppp/2p5/4P3/2B5/8/PPP1NnPP/RNBQK2R w KQkq - 0 6", 5, 70202861ull},
-		{nullptr, 0, 0}
-	};
-
-	uint64_t total = 0;
-	auto start = high_resolution_clock::now();
+namespace {
 
-	for (int i = 0; Test[i].s; i++) {
-		std::cout << Test[i].s << std::endl;
-		B.set_fen(Test[i].s);
-		if (perft(B, Test[i].depth, 0) != Test[i].value) {
-			std::cerr << "Incorrect perft" << std::endl;
-			return false;
-		}
-		total += Test[i].value;
-	}
+const char *BenchFEN[] = {
+	"r1bqkbnr/pp1ppppp/2n5/2p5/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq -",
+	"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
+	"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -",
+	"4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+	"rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+	"r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+	"1rbqk1nr/p3ppbp/2np2p1/2p5/1p2PP2/3PB1P1/PPPQ2BP/R2NK1NR b KQk -",
+	"r1bqk2r/pp1p1ppp/2n1pn2/2p5/1bPP4/2NBP3/PP2NPPP/R1BQK2R b KQkq -",
+	"rnb1kb1r/ppp2ppp/1q2p3/4P3/2P1Q3/5N2/PP1P1PPP/R1B1KB1R b KQkq -",
+	"r1b2rk1/pp2nppp/1b2p3/3p4/3N1P2/2P2NP1/PP3PBP/R3R1K1 b - -",
+	"n1q1r1k1/3b3n/p2p1bp1/P1pPp2p/2P1P3/2NBB2P/3Q1PK1/1R4N1 b - -",
+	"r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+	"3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+	"r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+	"4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+	"3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+	"2r5/8/1n6/1P1p1pkp/p2P4/R1P1PKP1/8/1R6 w - - 0 1",
+	"r2q1rk1/1b1nbppp/4p3/3pP3/p1pP4/PpP2N1P/1P3PP1/R1BQRNK1 b 0 1",
+	"6k1/5pp1/7p/p1p2n1P/P4N2/6P1/1P3P1K/8 w - - 0 35",
+	"r4rk1/1pp1q1pp/p2p4/3Pn3/1PP1Pp2/P7/3QB1PP/2R2RK1 b 0 1",
+	nullptr
+};
 
-	auto stop = high_resolution_clock::now();
-	int elapsed = duration_cast<microseconds>(stop - start).count();
-	std::cout << "speed: " << (int)(total / (double)elapsed * 1e6) << " leaf/sec" << std::endl;
-
-	return true;
-}
+}	// namespace
 
 bool test_see()
 {
@@ -109,62 +78,462 @@ bool test_see()
 			std::cout << "should be " << test[i].value << std::endl;
 			return false;
 		}
+
+		if (!move::see_ge(B, m, s) || move::see_ge(B, m, s + 1)) {
+			std::cout << B << "see_ge() inconsistent with SEE = " << s << std::endl;
+			return false;
+		}
 	}
 
 	return true;
 }
 
-void bench(int depth)
+bool test_book()
+// Polyglot keys, from the format specification
 {
-	static const char *test[] = {
-		"r1bqkbnr/pp1ppppp/2n5/2p5/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq -",
-		"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -",
-		"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -",
-		"4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
-		"rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
-		"r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
-		"1rbqk1nr/p3ppbp/2np2p1/2p5/1p2PP2/3PB1P1/PPPQ2BP/R2NK1NR b KQk -",
-		"r1bqk2r/pp1p1ppp/2n1pn2/2p5/1bPP4/2NBP3/PP2NPPP/R1BQK2R b KQkq -",
-		"rnb1kb1r/ppp2ppp/1q2p3/4P3/2P1Q3/5N2/PP1P1PPP/R1B1KB1R b KQkq -",
-		"r1b2rk1/pp2nppp/1b2p3/3p4/3N1P2/2P2NP1/PP3PBP/R3R1K1 b - -",
-		"n1q1r1k1/3b3n/p2p1bp1/P1pPp2p/2P1P3/2NBB2P/3Q1PK1/1R4N1 b - -",
-		"r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
-		"3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
-		"r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
-		"4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
-		"3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
-		"2r5/8/1n6/1P1p1pkp/p2P4/R1P1PKP1/8/1R6 w - - 0 1",
-		"r2q1rk1/1b1nbppp/4p3/3pP3/p1pP4/PpP2N1P/1P3PP1/R1BQRNK1 b 0 1",
-		"6k1/5pp1/7p/p1p2n1P/P4N2/6P1/1P3P1K/8 w - - 0 35",
-		"r4rk1/1pp1q1pp/p2p4/3Pn3/1PP1Pp2/P7/3QB1PP/2R2RK1 b 0 1",
-		nullptr
+	struct TestKey {
+		const char *fen;
+		Key key;
+	};
+
+	TestKey test[] = {
+		{"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 0x463b96181691fc9cULL},
+		{"rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1", 0x823c9b50fd114196ULL},
+		{"rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2", 0x0756b94461c50fb0ULL},
+		{"rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2", 0x662fafb965db29d4ULL},
+		{"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3", 0x22a48b5a8e47ff78ULL},
+		{"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR b kq - 0 3", 0x652a607ca3f242c1ULL},
+		{"rnbq1bnr/ppp1pkpp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR w - - 0 4", 0x00fdd303c946bdd9ULL},
+		{"rnbqkbnr/p1pppppp/8/8/PpP4P/8/1P1PPPP1/RNBQKBNR b KQkq c3 0 3", 0x3c8123ea7b067637ULL},
+		{"rnbqkbnr/p1pppppp/8/8/P6P/R1p5/1P1PPPP1/1NBQKBNR b Kkq - 0 4", 0x5c3f9b829b279560ULL},
+		{NULL, 0}
 	};
 
+	board::Board B;
+
+	for (int i = 0; test[i].fen; ++i) {
+		B.set_fen(test[i].fen);
+		std::cout << test[i].fen << std::endl;
+
+		if (book::key(B) != test[i].key) {
+			std::cout << B << std::hex << "key = " << book::key(B) << std::endl;
+			std::cout << "should be " << test[i].key << std::dec << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+namespace {
+
+void collect(board::Board& B, int depth, std::vector<std::string>& fens)
+// all positions up to depth plies from B
+{
+	fens.push_back(B.get_fen());
+
+	if (depth > 0) {
+		move::move_t mlist[MAX_MOVES], *end = movegen::gen_moves(B, mlist);
+		for (move::move_t *m = mlist; m < end; ++m) {
+			B.play(*m);
+			collect(B, depth - 1, fens);
+			B.undo();
+		}
+	}
+}
+
+double search_speed(int depth)
+// kn/s of the bench, without output
+{
+	board::Board B;
+	search::Limits sl;
+	sl.depth = depth;
+	uint64_t nodes = 0;
+
+	search::engine.uci_output = false;
+	search::engine.clear();
+	const auto start = high_resolution_clock::now();
+
+	for (int i = 0; BenchFEN[i]; ++i) {
+		B.set_fen(BenchFEN[i]);
+		nodes += search::engine.bestmove(B, sl).nodes;
+	}
+
+	const int64_t elapsed_usec = duration_cast<microseconds>(high_resolution_clock::now() - start).count();
+	search::engine.uci_output = true;
+	return nodes / (double)elapsed_usec * 1e3;
+}
+
+struct MicroStat {
+	// ns/op of each sample
+	const char *name;
+	uint64_t ops;	// per sample
+	std::vector<double> ns;
+
+	void report() const {
+		std::vector<double> v(ns);
+		std::sort(v.begin(), v.end());
+		double mean = 0, var = 0;
+		for (double x : v)
+			mean += x / v.size();
+		for (double x : v)
+			var += (x - mean) * (x - mean) / v.size();
+
+		std::printf("%-20s %10llu %9.1f %9.1f %9.1f %8.1f%%\n", name, (unsigned long long)ops, v.front(),
+			v[v.size() / 2], mean, 100 * std::sqrt(var) / mean);
+	}
+};
+
+}	// namespace
+
+bool bench_see()
+/* Microbenchmark: see() >= 0 against see_ge(0), for all moves in the positions up to 2 plies from the
+ * bench positions. Also checks that see_ge() agrees with see(), around 0 and around the SEE value. */
+{
+	const int reps = 20;
+	board::Board B;
+	std::vector<std::string> fens;
+	for (int i = 0; BenchFEN[i]; ++i) {
+		B.set_fen(BenchFEN[i]);
+		collect(B, 2, fens);
+	}
+
+	uint64_t calls = 0, mismatch = 0, sink = 0;
+	int64_t see_usec = 0, see_ge_usec = 0;
+
+	for (auto& fen : fens) {
+		B.set_fen(fen);
+		move::move_t mlist[MAX_MOVES], *end = movegen::gen_moves(B, mlist);
+
+		auto start = high_resolution_clock::now();
+		for (int r = 0; r < reps; ++r)
+			for (move::move_t *m = mlist; m < end; ++m)
+				sink += move::see(B, *m) >= 0;
+		auto middle = high_resolution_clock::now();
+		for (int r = 0; r < reps; ++r)
+			for (move::move_t *m = mlist; m < end; ++m)
+				sink += move::see_ge(B, *m, 0);
+		auto stop = high_resolution_clock::now();
+
+		see_usec += duration_cast<microseconds>(middle - start).count();
+		see_ge_usec += duration_cast<microseconds>(stop - middle).count();
+		calls += reps * (end - mlist);
+
+		for (move::move_t *m = mlist; m < end; ++m) {
+			const int s = move::see(B, *m);
+			for (int t : {0, 1, s, s + 1})
+				mismatch += move::see_ge(B, *m, t) != (s >= t);
+		}
+	}
+
+	std::cout << "positions = " << fens.size() << ", calls = " << calls << " (" << sink << ')' << std::endl;
+	std::cout << "see() >= 0 (ns/call) = " << see_usec * 1e3 / calls << std::endl;
+	std::cout << "see_ge(0) (ns/call) = " << see_ge_usec * 1e3 / calls << std::endl;
+	std::cout << "mismatches = " << mismatch << std::endl;
+
+	return !mismatch;
+}
+
+bool bench_nnue(const char *file_name)
+/* Network against symmetric_eval(): eval speed on the children of the positions up to 1 ply from the
+ * bench positions (the network is updated incrementally from the parent), and search speed at depth
+ * 10. Without a network file, random weights are used, so only speeds are meaningful. Also checks
+ * incremental evals against evals from scratch. */
+{
+	const int reps = 10, depth = 10;
+	board::Board B, fresh;
+	std::vector<std::string> fens;
+	for (int i = 0; BenchFEN[i]; ++i) {
+		B.set_fen(BenchFEN[i]);
+		collect(B, 1, fens);
+	}
+
+	uci::Threads = 1;
+	search::engine.TT.alloc(32ULL << 20);
+	const double classical_speed = search_speed(depth);
+
+	if (!file_name)
+		nnue::init_random(0);
+	else if (!nnue::load(file_name)) {
+		std::cerr << "cannot load network from " << file_name << std::endl;
+		return false;
+	}
+
+	eval::PawnCache PC;
+	eval::MaterialCache MC;
+	uint64_t evals = 0, mismatch = 0, sink = 0;
+	int64_t classical_usec = 0, nnue_usec = 0;
+
+	for (auto& fen : fens) {
+		B.set_fen(fen);
+		move::move_t mlist[MAX_MOVES], *end = movegen::gen_moves(B, mlist);
+		sink += nnue::evaluate(B);	// parent accumulator
+
+		// both loops pay for play(), is_check() and undo()
+		auto start = high_resolution_clock::now();
+		for (int r = 0; r < reps; ++r)
+			for (move::move_t *m = mlist; m < end; ++m) {
+				B.play(*m);
+				if (!B.is_check())
+					sink += eval::symmetric_eval(B, PC, MC);
+				B.undo();
+			}
+		auto middle = high_resolution_clock::now();
+		for (int r = 0; r < reps; ++r)
+			for (move::move_t *m = mlist; m < end; ++m) {
+				B.play(*m);
+				if (!B.is_check())
+					sink += nnue::evaluate(B);
+				B.undo();
+			}
+		auto stop = high_resolution_clock::now();
+
+		classical_usec += duration_cast<microseconds>(middle - start).count();
+		nnue_usec += duration_cast<microseconds>(stop - middle).count();
+
+		for (move::move_t *m = mlist; m < end; ++m) {
+			B.play(*m);
+			if (!B.is_check()) {
+				fresh.set_fen(B.get_fen());
+				mismatch += nnue::evaluate(B) != nnue::evaluate(fresh);
+				evals += reps;
+			}
+			B.undo();
+		}
+	}
+
+	const double nnue_speed = search_speed(depth);
+	nnue::clear();
+
+	std::cout << "network = " << (file_name ? file_name : "random") <<
+#ifdef __AVX2__
+		" (AVX2)"
+#else
+		" (scalar)"
+#endif
+		<< std::endl;
+	std::cout << "positions = " << fens.size() << ", evals = " << evals << " (" << sink << ')' << std::endl;
+	std::cout << "symmetric_eval (ns/eval) = " << classical_usec * 1e3 / evals << std::endl;
+	std::cout << "network (ns/eval) = " << nnue_usec * 1e3 / evals << std::endl;
+	std::cout << "mismatches = " << mismatch << std::endl;
+	std::cout << "symmetric_eval kn/s = " << classical_speed << std::endl;
+	std::cout << "network kn/s = " << nnue_speed << std::endl;
+
+	return !mismatch;
+}
+
+void bench(int depth, int threads, int hash)
+{
 	board::Board B;
 	search::Limits sl;
 	sl.depth = depth;
 	uint64_t nodes = 0;
 
-	search::TT.alloc(32ULL << 20);
-	search::clear_state();
+	uci::Threads = threads;
+	search::engine.TT.alloc((uint64_t)hash << 20);
+	search::engine.clear();
 
 	time_point<high_resolution_clock> start, end;
 	start = high_resolution_clock::now();
 
-	for (int i = 0; test[i]; ++i) {
-		B.set_fen(test[i]);
+	for (int i = 0; BenchFEN[i]; ++i) {
+		B.set_fen(BenchFEN[i]);
 
 		std::cout << B.get_fen() << std::endl;
-		bestmove(B, sl);
+		nodes += search::engine.bestmove(B, sl).nodes;
 		std::cout << std::endl;
-
-		nodes += search::node_count;
 	}
 
 	end = high_resolution_clock::now();
 	int64_t elapsed_usec = duration_cast<microseconds>(end - start).count();
 
+	std::cout << "threads = " << threads << std::endl;
+	std::cout << "hash (MB) = " << hash << " (" << search::engine.TT.get_mode() << ')' << std::endl;
+	eval::CacheStats ec, pc;
+	search::engine.cache_stats(ec, pc);
+	std::cout << "eval cache (KB) = " << uci::EvalCache << ", hits = " << ec.hit_rate() << "% of "
+		<< ec.probes << std::endl;
+	std::cout << "pawn cache (KB) = " << uci::PawnCache << ", hits = " << pc.hit_rate() << "% of "
+		<< pc.probes << std::endl;
+	std::cout << "time (ms) = " << elapsed_usec / 1000 << std::endl;
 	std::cout << "nodes = " << nodes << std::endl;
 	std::cout << "kn/s = " << nodes / (double)elapsed_usec * 1e3 << std::endl;
 }
 
+void bench_micro(int reps, const char *file_name)
+/* Microbenchmarks of the hot paths, each timed on its own over a corpus of positions: the positions
+ * of an EPD file, or those up to 2 plies from the bench positions. The first pass is a warm-up, then
+ * each of the reps passes is a sample: ns/op are reported as min, median, mean, and relative standard
+ * deviation of the samples. Operations are repeated on each position, so that the cost of reading
+ * the clock is amortized (evals hit the pawn and material caches, as they mostly do in the search). */
+{
+	const int inner = 8;
+	board::Board B;
+	std::vector<std::string> fens;
+
+	if (file_name) {
+		std::ifstream epd(file_name);
+		if (!epd.is_open()) {
+			std::cerr << "cannot open " << file_name << std::endl;
+			return;
+		}
+		std::string line;
+		while (getline(epd, line)) {
+			std::istringstream is(line);
+			std::string fen, field;
+			for (int i = 0; i < 4 && is >> field; ++i)
+				fen += field + ' ';
+			if (std::count(fen.begin(), fen.end(), ' ') == 4 && fen[0] != '#')
+				fens.push_back(fen);
+		}
+	} else
+		for (int i = 0; BenchFEN[i]; ++i) {
+			B.set_fen(BenchFEN[i]);
+			collect(B, 2, fens);
+		}
+
+	// locals, so that every run starts with cold caches
+	eval::PawnCache PC;
+	eval::MaterialCache MC;
+	History H;
+	std::unique_ptr<Refutation> R(new Refutation);	// 512 KB
+	H.clear();
+	R->clear();
+	SearchInfo ss;
+	ss.clear(0);
+
+	TTable TT;
+	TT.alloc(64ULL << 20);
+	std::vector<Key> keys;	// the positions and their children, for the TT
+
+	enum { GEN_MOVES, PLAY_UNDO, SEE, EVAL, MOVESORT, MOVESORT_QS, TT_STORE, TT_PROBE, NB_MICRO };
+	MicroStat stats[NB_MICRO] = {
+		{"gen_moves", 0, {}}, {"play+undo", 0, {}}, {"see", 0, {}}, {"symmetric_eval", 0, {}},
+		{"MoveSort (search)", 0, {}}, {"MoveSort (qsearch)", 0, {}}, {"TT store", 0, {}},
+		{"TT probe", 0, {}}
+	};
+	uint64_t sink = 0;
+
+	for (int rep = 0; rep <= reps; ++rep) {
+		int64_t ns[NB_MICRO] = {};
+		uint64_t ops[NB_MICRO] = {};
+		auto clock = [&](int i, time_point<high_resolution_clock> start, uint64_t n) {
+			ns[i] += duration_cast<nanoseconds>(high_resolution_clock::now() - start).count();
+			ops[i] += n;
+		};
+
+		for (auto& fen : fens) {
+			B.set_fen(fen);
+			move::move_t mlist[MAX_MOVES], *end = movegen::gen_moves(B, mlist);
+			const int n = end - mlist;
+
+			auto start = high_resolution_clock::now();
+			for (int r = 0; r < inner; ++r)
+				sink += movegen::gen_moves(B, mlist) - mlist;
+			clock(GEN_MOVES, start, inner);
+
+			start = high_resolution_clock::now();
+			for (move::move_t *m = mlist; m < end; ++m) {
+				B.play(*m);
+				B.undo();
+			}
+			clock(PLAY_UNDO, start, n);
+
+			start = high_resolution_clock::now();
+			for (move::move_t *m = mlist; m < end; ++m)
+				sink += move::see(B, *m);
+			clock(SEE, start, n);
+
+			if (!B.is_check()) {
+				start = high_resolution_clock::now();
+				for (int r = 0; r < inner; ++r)
+					sink += eval::symmetric_eval(B, PC, MC);
+				clock(EVAL, start, inner);
+			}
+
+			for (int i : {MOVESORT, MOVESORT_QS}) {
+				start = high_resolution_clock::now();
+				for (int r = 0; r < inner; ++r) {
+					MoveSort MS(&B, i == MOVESORT ? 4 : -1, &ss, &H, R.get());
+					while (move::move_t m = MS.next())
+						sink += m.tsq();
+				}
+				clock(i, start, inner);
+			}
+
+			if (!rep) {
+				keys.push_back(B.get_key());
+				for (move::move_t *m = mlist; m < end; ++m) {
+					B.play(*m);
+					keys.push_back(B.get_key());
+					B.undo();
+				}
+			}
+		}
+
+		// TT: one pass over all the keys, which are scattered in a table much larger than the cache
+		auto start = high_resolution_clock::now();
+		for (size_t i = 0; i < keys.size(); ++i)
+			TT.store(keys[i], PV, i & 15, i & 255, 0, move::move_t(0));
+		clock(TT_STORE, start, keys.size());
+
+		start = high_resolution_clock::now();
+		for (Key k : keys)
+			sink += TT.probe(k) != nullptr;
+		clock(TT_PROBE, start, keys.size());
+
+		if (rep)	// the first pass is a warm-up
+			for (int i = 0; i < NB_MICRO; ++i) {
+				stats[i].ops = ops[i];
+				stats[i].ns.push_back(ns[i] / (double)std::max<uint64_t>(ops[i], 1));
+			}
+	}
+
+	std::cout << "positions = " << fens.size() << ", samples = " << reps << " (" << sink % 10 << ')'
+		<< std::endl;
+	std::printf("%-20s %10s %9s %9s %9s %9s\n", "ns/op", "ops", "min", "median", "mean", "stddev");
+	for (auto& s : stats)
+		s.report();
+}
+
+void bench_stop(int msec)
+/* Measures the stop latency of the search: each bench position is searched for msec, then the stop
+ * signal is raised from another thread, and we time how long it takes for bestmove() to return.
+ * Also reports the nps, to see the cost of the abort mechanism in the search itself. */
+{
+	board::Board B;
+	search::Limits sl;
+	uint64_t nodes = 0;
+	std::vector<int64_t> latency;
+
+	search::engine.TT.alloc(32ULL << 20);
+	search::engine.clear();
+
+	auto start = high_resolution_clock::now();
+
+	for (int i = 0; BenchFEN[i]; ++i) {
+		B.set_fen(BenchFEN[i]);
+		search::stop_signal = false;
+
+		time_point<high_resolution_clock> signaled;
+		std::thread stopper([&] {
+			std::this_thread::sleep_for(milliseconds(msec));
+			signaled = high_resolution_clock::now();
+			search::stop_signal = true;
+		});
+
+		nodes += search::engine.bestmove(B, sl).nodes;
+		const auto returned = high_resolution_clock::now();
+		stopper.join();
+
+		latency.push_back(duration_cast<microseconds>(returned - signaled).count());
+	}
+
+	const int64_t elapsed_usec = duration_cast<microseconds>(high_resolution_clock::now() - start).count();
+	std::sort(latency.begin(), latency.end());
+
+	std::cout << "stop latency (us): min " << latency.front()
+		<< " median " << latency[latency.size() / 2]
+		<< " max " << latency.back() << std::endl;
+	std::cout << "kn/s = " << nodes / (double)elapsed_usec * 1e3 << std::endl;
+}
@@ -1,9 +1,12 @@
 #pragma once
 #include "board.h"
 
-extern uint64_t perft(board::Board& B, int depth, int ply);
-extern bool test_perft();
 extern bool test_see();
+extern bool test_book();
+extern bool bench_see();
+extern bool bench_nnue(const char *file_name);
 
-extern void bench(int depth);
+extern void bench(int depth, int threads, int hash);
+extern void bench_stop(int msec);
+extern void bench_micro(int reps, const char *file_name);
 
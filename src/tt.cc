@@ -16,12 +16,45 @@
  * - TT entry replacement scheme replicates what Stockfish does. Thanks to Tord Romstad and Marco
  * Costalba.
 */
+#include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "tt.h"
 #include "move.h"
 
 namespace {
 
+/* Snapshot file: this header, followed by the cluster array. Version must be incremented whenever
+ * the layout of TTable::Entry changes. */
+struct FileHeader {
+	char magic[8];
+	uint32_t version, entry_size;
+	uint64_t entry_count;
+	uint8_t generation;
+	char reserved[39];
+};
+static_assert(sizeof(FileHeader) == 64, "the cluster array must stay 64-byte aligned in the file");
+
+static_assert(sizeof(TTable::Cluster) == 64, "a cluster must fit in a cache line");
+
+const char Magic[8] = "DiscoTT";
+const uint32_t Version = 2;
+
 void *aligned_malloc(size_t size, size_t align)
 {
 	void *mem = malloc(size + (align - 1) + sizeof(void*));
@@ -39,65 +72,306 @@ void aligned_free(void *mem)
 	free(((void**)mem)[-1]);
 }
 
+#ifdef __linux__
+
+void *map_anonymous(size_t size, std::string& mode)
+/* Random TT probes pay a TLB miss on almost every node with 4KB pages. So try explicit huge pages
+ * first (1GB, then 2MB), which only exist if reserved by the administrator (vm.nr_hugepages), then
+ * transparent huge pages. Returns nullptr if mmap() fails. */
+{
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	const struct {
+		int flags;
+		size_t page_size;
+		const char *mode;
+	} Huge[] = {
+		{MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), 1ULL << 30, "1GB pages"},
+		{MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), 2ULL << 20, "2MB pages"}
+	};
+
+	for (auto& h : Huge)
+		if (size % h.page_size == 0) {
+			void *m = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags | h.flags, -1, 0);
+			if (m != MAP_FAILED) {
+				mode = h.mode;
+				return m;
+			}
+		}
+
+	void *m = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (m == MAP_FAILED)
+		return nullptr;
+
+	mode = madvise(m, size, MADV_HUGEPAGE) ? "4KB pages" : "transparent huge pages";
+	return m;
+}
+
+unsigned long numa_nodes()
+// Mask of the online NUMA nodes (eg. "0-1,3" in sysfs)
+{
+	std::ifstream f("/sys/devices/system/node/online");
+	std::string list, range;
+	unsigned long mask = 0;
+
+	if (f >> list) {
+		std::istringstream is(list);
+		while (getline(is, range, ',')) {
+			const size_t dash = range.find('-');
+			const int first = std::stoi(range);
+			const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+			for (int n = first; n <= last && n < 64; ++n)
+				mask |= 1UL << n;
+		}
+	}
+
+	return mask;
+}
+
+void interleave(void *m, size_t size, std::string& mode)
+// On multi-socket hosts, spread the pages over all NUMA nodes, rather than the node of the thread
+// that happens to clear the table. Must be called before the pages are touched.
+{
+	unsigned long mask = numa_nodes();
+	const int nodes = bb::count_bit(mask);
+
+	if (nodes > 1 && !syscall(SYS_mbind, m, size, MPOL_INTERLEAVE, &mask, 8 * sizeof(mask), 0))
+		mode += ", interleaved on " + std::to_string(nodes) + " NUMA nodes";
+}
+
+#endif
+
 }	// namespace
 
 TTable::~TTable()
 {
-	if (count)
+	free_table();
+	generation = 0;
+}
+
+void TTable::free_table()
+{
+	wait();
+
+#ifndef _WIN32
+	if (mapping)
+		munmap(mapping, mapping_size);
+	else
+#endif
+	if (cluster)
 		aligned_free(cluster);
 
 	cluster = nullptr;
-	generation = 0;
+	mapping = nullptr;
+	mapping_size = 0;
 	count = 0;
 }
 
-void TTable::alloc(uint64_t size)
+bool TTable::alloc(uint64_t size, bool background)
 {
 	// calculate the number of clusters allocate (count must be a power of two)
-	size_t new_count = 1ULL << bb::msb(size / sizeof(Cluster));
+	size_t new_count = 1ULL << bb::msb(std::max<uint64_t>(size / sizeof(Cluster), 1));
 
 	// nothing to do if already allocated to the given size
 	if (new_count == count)
-		return;
+		return false;
 
-	if (cluster)
-		aligned_free(cluster);
+	free_table();
+	const size_t bytes = new_count * sizeof(Cluster);
+	count = new_count;
+	generation = 0;
+
+#ifdef __linux__
+	// anonymous mappings are zeroed by the kernel, page by page, when first touched: no need to
+	// clear the table, which makes alloc() instant even for huge tables.
+	if ( (mapping = map_anonymous(bytes, mode)) ) {
+		mapping_size = bytes;
+		interleave(mapping, bytes, mode);
+		cluster = (Cluster *)mapping;
+		return true;
+	}
+#endif
 
 	// Allocate the cluster array. On failure, std::bad_alloc is thrown and not caught, which
 	// terminates the program. It's not a bug, it's a "feature".
-	cluster = (Cluster *)aligned_malloc(new_count * sizeof(Cluster), 64);
-
-	count = new_count;
-	clear();
+	cluster = (Cluster *)aligned_malloc(bytes, 64);
+	mode = "malloc";
+	clear(background);
+	return true;
 }
 
-void TTable::clear()
+void TTable::clear(bool background)
 {
-	std::memset(cluster, 0, count * sizeof(Cluster));
+	wait();
 	generation = 0;
+
+	if (background)
+		clearer = std::thread(&TTable::zero, this);
+	else
+		zero();
+}
+
+void TTable::wait()
+{
+	if (clearer.joinable())
+		clearer.join();
+}
+
+void TTable::zero()
+/* Clearing a multi-GB table is memory bound, and one core can not saturate the memory bandwidth:
+ * split the memset between threads (one per 16MB, up to the number of hardware threads). */
+{
+	if (!count)
+		return;
+
+	char *base = (char *)(void *)cluster;
+	const size_t bytes = count * sizeof(Cluster);
+	const size_t threads = std::max<size_t>(1,
+		std::min<size_t>(std::thread::hardware_concurrency(), bytes >> 24));
+	const size_t chunk = count / threads * sizeof(Cluster);	// bytes, whole clusters
+
+	std::vector<std::thread> helpers;
+	for (size_t i = 1; i < threads; ++i) {
+		char *begin = base + i * chunk;
+		const size_t n = i == threads - 1 ? bytes - i * chunk : chunk;
+		helpers.emplace_back([=] { std::memset(begin, 0, n); });
+	}
+
+	std::memset(base, 0, threads == 1 ? bytes : chunk);
+	for (auto& t : helpers)
+		t.join();
+}
+
+bool TTable::save(const std::string& file_name)
+{
+	wait();
+	if (!count)
+		return false;
+
+	FILE *f = fopen(file_name.c_str(), "wb");
+	if (!f)
+		return false;
+
+	FileHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, Magic, sizeof(Magic));
+	h.version = Version;
+	h.entry_size = sizeof(Entry);
+	h.entry_count = count * ClusterSize;
+	h.generation = generation;
+
+	const bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+		&& fwrite(cluster, sizeof(Cluster), count, f) == count;
+	return fclose(f) == 0 && ok;
+}
+
+bool TTable::load(const std::string& file_name)
+/* The table takes the size of the snapshot. On POSIX systems, the file is mapped copy-on-write:
+ * pages are only read from disk when the search first touches them, and what the search writes
+ * stays in memory, leaving the file intact. */
+{
+	FILE *f = fopen(file_name.c_str(), "rb");
+	if (!f)
+		return false;
+
+	FileHeader h;
+	const size_t entries = ClusterSize;
+	bool ok = fread(&h, sizeof(h), 1, f) == 1
+		&& !std::memcmp(h.magic, Magic, sizeof(Magic))
+		&& h.version == Version && h.entry_size == sizeof(Entry)
+		&& h.entry_count >= entries && h.entry_count % entries == 0;
+
+	// the number of clusters must be a power of two, and match the file size
+	const size_t new_count = ok ? h.entry_count / entries : 0;
+	const uint64_t file_size = sizeof(h) + (uint64_t)new_count * sizeof(Cluster);
+	ok = ok && !(new_count & (new_count - 1)) && new_count * sizeof(Cluster) >= MinSize
+		&& !fseek(f, 0, SEEK_END) && (uint64_t)ftell(f) == file_size;
+
+	if (!ok) {
+		fclose(f);
+		return false;
+	}
+
+#ifndef _WIN32
+	fclose(f);
+	const int fd = open(file_name.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	void *m = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED)
+		return false;
+
+	free_table();
+	mapping = m;
+	mapping_size = file_size;
+	cluster = (Cluster *)((char *)m + sizeof(h));
+	mode = "file mapping";
+#else
+	Cluster *c = (Cluster *)aligned_malloc(new_count * sizeof(Cluster), 64);
+	ok = !fseek(f, sizeof(h), SEEK_SET) && fread(c, sizeof(Cluster), new_count, f) == new_count;
+	fclose(f);
+	if (!ok) {
+		aligned_free(c);
+		return false;
+	}
+
+	free_table();
+	cluster = c;
+	mode = "malloc";
+#endif
+
+	count = new_count;
+	generation = h.generation;
+	return true;
 }
 
 void TTable::new_search()
 {
-	++generation;
+	generation = (generation + 1) & 63;
+}
+
+int TTable::hashfull() const
+// Samples the first 1000 entries (or so)
+{
+	const size_t n = std::min<size_t>(count, 1000 / ClusterSize);
+	int used = 0;
+
+	for (size_t i = 0; i < n; ++i)
+		for (const Entry& e : cluster[i].entry)
+			used += e.gen_bound && e.generation() == generation;
+
+	return n ? used * 1000 / (n * ClusterSize) : 0;
 }
 
 const TTable::Entry *TTable::probe(Key key) const
 {
-	const Entry *e = &cluster[key & (count - 1)].entry[0];
+	const Cluster& c = cluster[key & (count - 1)];
+	const uint16_t k = key_fragment(key);
+
+#ifdef __SSE2__
+	// compare the 6 key fragments at once: 2 bits per match in the mask
+	const __m128i keys = _mm_load_si128((const __m128i *)c.key);
+	unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi16(keys, _mm_set1_epi16(k))) & 0xfff;
 
-	for (size_t i = 0; i < 4; ++i, ++e)
-		if (e->key_match(key))
-			return e;
+	while (mask) {
+		const int i = bb::lsb(mask) / 2;
+		mask &= ~(3U << (2 * i));
+		if (c.entry[i].gen_bound)
+			return &c.entry[i];
+	}
+#else
+	for (int i = 0; i < ClusterSize; ++i)
+		if (c.key[i] == k && c.entry[i].gen_bound)
+			return &c.entry[i];
+#endif
 
 	return nullptr;
 }
 
-void TTable::Entry::save(Key k, uint8_t g, int nt, int8_t d, int16_t s, int16_t e,
-						 move::move_t m)
+void TTable::Entry::save(uint8_t g, int nt, int8_t d, int16_t s, int16_t e, move::move_t m)
 {
-	key_type = (k & ~3ULL) ^ (nt + 1);
-	generation = g;
+	gen_bound = (g << 2) | (nt + 2);
 	depth = d;
 	score = s;
 	eval = e;
@@ -106,27 +380,33 @@ void TTable::Entry::save(Key k, uint8_t g, int nt, int8_t d, int16_t s, int16_t
 
 void TTable::store(Key key, int node_type, int8_t depth, int16_t score, int16_t eval, move::move_t move)
 {
-	Entry *e = cluster[key & (count - 1)].entry, *replace = e;
+	Cluster& c = cluster[key & (count - 1)];
+	const uint16_t k = key_fragment(key);
+	int replace = 0;
 
 	if (node_type == All)
 		move = move::move_t(0);
 
-	for (size_t i = 0; i < 4; ++i, ++e) {
+	for (int i = 0; i < ClusterSize; ++i) {
+		const Entry& e = c.entry[i];
+
 		// overwrite empty or old
-		if (!e->key_type || e->key_match(key)) {
-			replace = e;
+		if (!e.gen_bound || c.key[i] == k) {
+			replace = i;
 			if (!move)
-				move = e->move;
+				move = e.move;
 			break;
 		}
 
 		// Stockfish replacement strategy
-		int c1 = generation == replace->generation ? 2 : 0;
-		int c2 = e->generation == generation || e->node_type() == PV ? -2 : 0;
-		int c3 = e->depth < replace->depth ? 1 : 0;
+		const Entry& r = c.entry[replace];
+		int c1 = generation == r.generation() ? 2 : 0;
+		int c2 = e.generation() == generation || e.node_type() == PV ? -2 : 0;
+		int c3 = e.depth < r.depth ? 1 : 0;
 		if (c1 + c2 + c3 > 0)
-			replace = e;
+			replace = i;
 	}
 
-	replace->save(key, generation, node_type, depth, score, eval, move);
+	c.entry[replace].save(generation, node_type, depth, score, eval, move);
+	c.key[replace] = k;
 }
@@ -13,46 +13,71 @@
  * see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <string>
+#include <thread>
 #include "board.h"
 
 enum { PV = 0, All = -1, Cut = +1 };
 
 class TTable {
 public:
+	/* The key is not stored in the entry: the cluster index is given by the low bits of the key,
+	 * and the cluster holds a 16-bit fragment of the high bits for each entry. */
 	struct Entry {
-		Key key_type;	// bit 0..1 for node_type+1, and 2..63 for key's 62 MSB
-		mutable uint8_t generation;
+		mutable uint8_t gen_bound;	// bit 0..1 for node_type+2 (0 if empty), and 2..7 for generation
 		int8_t depth;
 		int16_t score, eval;
 		move::move_t move;
 
 		int node_type() const {
-			return (key_type & 3) - 1;
+			return (gen_bound & 3) - 2;
 		}
 
-		bool key_match(Key k) const {
-			return (key_type & ~3ULL) == (k & ~3ULL);
+		int generation() const {
+			return gen_bound >> 2;
 		}
 
-		void save(Key k, uint8_t g, int nt, int8_t d, int16_t s, int16_t e,
-				  move::move_t m);
+		void save(uint8_t g, int nt, int8_t d, int16_t s, int16_t e, move::move_t m);
 	};
 
+	/* 6 entries in a 64-byte cache line. Key fragments are packed together, so that probe() can
+	 * compare them all at once. */
+	static const int ClusterSize = 6;
 	struct Cluster {
-		Entry entry[4];
+		uint16_t key[8];	// key[6..7] are padding (probe() loads 16 bytes)
+		Entry entry[ClusterSize];
 	};
 
-	TTable(): count(0), cluster(nullptr) {}
+	static uint16_t key_fragment(Key key) {
+		return key >> 48;
+	}
+
+	TTable(): count(0), generation(0), cluster(nullptr), mapping(nullptr), mapping_size(0) {}
 	~TTable();
 
-	void alloc(uint64_t size);
-	void clear();
+	/* Both can clear the table in a background thread, and return immediately. In that case,
+	 * wait() must be called before using the table (search::Context::bestmove() does). */
+	bool alloc(uint64_t size, bool background = false);	// returns true if the table was (re)allocated
+	void clear(bool background = false);
+	void wait();
+
+	// Snapshots: the table (and its size) can be saved to a file, and loaded back later
+	static const uint64_t MinSize = 1ULL << 20;	// 1 MB (the minimum Hash): smaller snapshots are rejected
+	bool save(const std::string& file_name);	// waits for a background clear
+	bool load(const std::string& file_name);
+	uint64_t size() const {
+		return count * sizeof(Cluster);
+	}
+	const std::string& get_mode() const {
+		return mode;	// how the memory was obtained (page size, NUMA policy, etc.)
+	}
 
 	void new_search();
 	void refresh(const Entry *e) const {
-		e->generation = generation;
+		e->gen_bound = (e->gen_bound & 3) | (generation << 2);
 	}
 
+	int hashfull() const;	// permill of entries written by the current search (sampled)
 	const Entry *probe(Key key) const;
 	void prefetch(Key key) const {
 		__builtin_prefetch((char *)&cluster[key & (count - 1)]);
@@ -61,7 +86,17 @@ public:
 
 private:
 	size_t count;
-	uint8_t generation;
+	uint8_t generation;	// 6 bits
 	Cluster *cluster;
+
+	// When the table is mmap()ed (anonymous memory, or a snapshot file), cluster points into it
+	void *mapping;
+	size_t mapping_size;
+	std::string mode;
+
+	std::thread clearer;
+
+	void free_table();
+	void zero();
 };
 
@@ -0,0 +1,322 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+ *
+ * Credits:
+ * - Texel tuning is due to Peter Österlund (author of Texel).
+*/
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "tune.h"
+#include "eval.h"
+#include "movegen.h"
+#include "psq.h"
+#include "selfplay.h"
+
+using namespace std::chrono;
+
+namespace {
+
+const int MaxQPly = 16;
+const size_t BlockSize = 1 << 20;	// EPD lines read and resolved at once
+
+// Per thread eval state: caches must be cleared whenever parameters change
+struct Evaluator {
+	Evaluator(): PC(256) {}
+	board::Board B;
+	eval::PawnCache PC;
+	eval::MaterialCache MC;
+	move::move_t pv[MaxQPly + 1][MaxQPly + 1];
+
+	int qsearch(int alpha, int beta, int ply);
+	void clear() { PC.clear(); MC.clear(); }
+};
+
+int Evaluator::qsearch(int alpha, int beta, int ply)
+/* Captures and promotions that don't lose material (all evasions when in check). The PV leads to
+ * the resolved position. */
+{
+	pv[ply][0] = move::move_t(0);
+	const bool in_check = B.is_check();
+	int best_score = -INF;
+
+	if (!in_check) {
+		best_score = eval::symmetric_eval(B, PC, MC);
+		if (best_score > alpha && (alpha = best_score) >= beta)
+			return best_score;
+	}
+
+	if (ply >= MaxQPly)
+		return in_check ? 0 : best_score;
+
+	move::move_t mlist[MAX_MOVES];
+	move::move_t *end = movegen::gen_moves(B, mlist);
+
+	for (move::move_t *m = mlist; m != end; ++m) {
+		if (!in_check && (!move::is_cop(B, *m) || !move::see_ge(B, *m, 0)))
+			continue;
+
+		B.play(*m);
+		const int score = -qsearch(-beta, -alpha, ply + 1);
+		B.undo();
+
+		if (score > best_score) {
+			best_score = score;
+			if (score > alpha) {
+				alpha = score;
+				pv[ply][0] = *m;
+				for (int i = 0; (pv[ply][i + 1] = pv[ply + 1][i]); ++i);
+				if (score >= beta)
+					break;
+			}
+		}
+	}
+
+	return best_score == -INF ? -MATE + ply : best_score;
+}
+
+bool parse_epd(const std::string& line, std::string& fen, int& result)
+// 4 FEN fields, and the result (for White) found anywhere after them
+{
+	static const char *Results[][2] = {
+		{"1/2-1/2", "[0.5]"}, {"0-1", "[0.0]"}, {"1-0", "[1.0]"}
+	};
+
+	std::istringstream is(line);
+	std::string field;
+	fen.clear();
+	for (int i = 0; i < 4; ++i) {
+		if (!(is >> field))
+			return false;
+		fen += field + ' ';
+	}
+
+	const std::string rest = line.substr(is.tellg() < 0 ? line.size() : (size_t)is.tellg());
+	for (int r = 0; r < 3; ++r)
+		if (rest.find(Results[r][0]) != std::string::npos || rest.find(Results[r][1]) != std::string::npos) {
+			result = r == 0 ? 0 : r == 1 ? -1 : 1;
+			return true;
+		}
+
+	return false;
+}
+
+template <typename F>
+void parallel_for(size_t n, int threads, F f)
+// f(thread index, i) for i in 0..n-1, split in contiguous slices
+{
+	std::vector<std::thread> pool;
+	for (int t = 0; t < threads; ++t)
+		pool.emplace_back([=, &f] {
+			for (size_t i = n * t / threads; i < n * (t + 1) / threads; ++i)
+				f(t, i);
+		});
+	for (auto& t : pool)
+		t.join();
+}
+
+void resolve(const std::vector<std::string>& lines, std::vector<Evaluator>& ev,
+	std::vector<selfplay::PackedPosition>& data)
+/* Appends the quiet positions at the end of the qsearch PV of each position, with its result.
+ * Positions in check, and mate scores, are skipped. */
+{
+	const int threads = ev.size();
+	std::vector<std::vector<selfplay::PackedPosition>> out(threads);
+
+	parallel_for(lines.size(), threads, [&](int t, size_t i) {
+		std::string fen;
+		int result = 0;
+		if (!parse_epd(lines[i], fen, result))
+			return;
+
+		board::Board& B = ev[t].B;
+		B.set_fen(fen);
+		if (B.is_check())
+			return;
+
+		const int score = ev[t].qsearch(-INF, +INF, 0);
+		if (std::abs(score) >= MATE - MAX_PLY)
+			return;
+
+		int plies = 0;
+		for (; ev[t].pv[0][plies]; ++plies)
+			B.play(ev[t].pv[0][plies]);
+
+		if (!B.is_check()) {
+			out[t].emplace_back();
+			selfplay::pack(B, 0, move::move_t(0), out[t].back());
+			out[t].back().result = B.get_turn() == WHITE ? result : -result;
+		}
+
+		while (plies--)
+			B.undo();
+	});
+
+	for (auto& o : out)
+		data.insert(data.end(), o.begin(), o.end());
+}
+
+double error(const std::vector<selfplay::PackedPosition>& data, std::vector<Evaluator>& ev, double K)
+// Mean squared error between results (0, 1/2, 1) and predicted scores (sigmoid of the eval)
+{
+	const int threads = ev.size();
+	std::vector<double> sum(threads, 0.0);
+
+	for (auto& e : ev)
+		e.clear();
+
+	parallel_for(data.size(), threads, [&](int t, size_t i) {
+		const selfplay::PackedPosition& p = data[i];
+		selfplay::unpack(p, ev[t].B);
+		const int eval = eval::symmetric_eval(ev[t].B, ev[t].PC, ev[t].MC);
+		const double predicted = 1.0 / (1.0 + std::pow(10.0, -K * eval / 400.0));
+		const double d = (p.result + 1) / 2.0 - predicted;
+		sum[t] += d * d;
+	});
+
+	double total = 0.0;
+	for (double s : sum)
+		total += s;
+	return total / std::max<size_t>(data.size(), 1);
+}
+
+double fit_scaling(const std::vector<selfplay::PackedPosition>& data, std::vector<Evaluator>& ev)
+// K minimizing the error, by golden section search
+{
+	const double phi = (std::sqrt(5.0) - 1) / 2;
+	double a = 0.1, b = 3.0;
+	double c = b - phi * (b - a), d = a + phi * (b - a);
+	double ec = error(data, ev, c), ed = error(data, ev, d);
+
+	while (b - a > 0.005) {
+		if (ec < ed) {
+			b = d; d = c; ed = ec;
+			c = b - phi * (b - a);
+			ec = error(data, ev, c);
+		} else {
+			a = c; c = d; ec = ed;
+			d = a + phi * (b - a);
+			ed = error(data, ev, d);
+		}
+	}
+
+	return (a + b) / 2;
+}
+
+}	// namespace
+
+void tune(int argc, char **argv)
+{
+	if (argc < 3) {
+		std::cerr << "usage: " << argv[0] << " tune <file.epd> [--threads n] [--iterations n]"
+			" [--params file] [--output file]" << std::endl;
+		return;
+	}
+
+	std::ifstream epd(argv[2]);
+	if (!epd.is_open()) {
+		std::cerr << "cannot open " << argv[2] << std::endl;
+		return;
+	}
+
+	int threads = std::max<int>(std::thread::hardware_concurrency(), 1), iterations = 100;
+	std::string output = "params.txt";
+
+	for (int i = 3; i + 1 < argc; i += 2) {
+		const std::string option(argv[i]);
+		if (option == "--threads")
+			threads = std::max(std::atoi(argv[i + 1]), 1);
+		else if (option == "--iterations")
+			iterations = std::max(std::atoi(argv[i + 1]), 0);
+		else if (option == "--params") {
+			if (!eval::load_params(argv[i + 1])) {
+				std::cerr << "cannot load parameters from " << argv[i + 1] << std::endl;
+				return;
+			}
+		} else if (option == "--output")
+			output = argv[i + 1];
+	}
+
+	const auto start = high_resolution_clock::now();
+	auto elapsed_sec = [&] {
+		return duration_cast<seconds>(high_resolution_clock::now() - start).count();
+	};
+
+	std::vector<Evaluator> ev(threads);
+	std::vector<selfplay::PackedPosition> data;
+	std::vector<std::string> lines;
+	std::string line;
+	size_t line_count = 0;
+
+	while (getline(epd, line)) {
+		lines.push_back(line);
+		if (lines.size() == BlockSize) {
+			resolve(lines, ev, data);
+			line_count += lines.size();
+			lines.clear();
+		}
+	}
+	resolve(lines, ev, data);
+	line_count += lines.size();
+
+	std::cout << "positions: " << data.size() << " resolved, out of " << line_count << " lines ("
+		<< elapsed_sec() << " s)" << std::endl;
+	if (data.empty())
+		return;
+
+	const double K = fit_scaling(data, ev);
+	double best = error(data, ev, K);
+	std::cout << "K = " << K << ", error = " << best << " (" << elapsed_sec() << " s)" << std::endl;
+
+	// Local search: each parameter is moved by +/- 1, as long as the error decreases
+	std::vector<Param> params = eval::params();
+
+	for (int it = 1; it <= iterations; ++it) {
+		int changes = 0;
+
+		for (auto& p : params) {
+			const int old = *p.value;
+			for (int delta : {+1, -1}) {
+				if (old + delta < p.min || old + delta > p.max)
+					continue;
+				*p.value = old + delta;
+				psq::init();
+				const double e = error(data, ev, K);
+				if (e < best) {
+					best = e;
+					++changes;
+					break;
+				}
+				*p.value = old;
+				psq::init();
+			}
+		}
+
+		std::cout << "iteration " << it << ": error = " << best << ", " << changes
+			<< " changes (" << elapsed_sec() << " s)" << std::endl;
+
+		std::ofstream os(output);
+		eval::save_params(os);
+
+		if (!changes)
+			break;
+	}
+
+	eval::save_params(std::cout);
+}
@@ -0,0 +1,23 @@
+/*
+ * DiscoCheck, an UCI chess engine. Copyright (C) 2011-2013 Lucas Braesch.
+ *
+ * DiscoCheck is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * DiscoCheck is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program. If not,
+ * see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+/* Texel tuning of the eval parameters (see eval::params()), from the command line:
+ * discocheck tune <file.epd> [--threads n] [--iterations n] [--params file] [--output file]
+ * Each line of the file is a position with its game result, eg. '<fen> c9 "1-0";' (also accepted:
+ * "1/2-1/2", "0-1", [1.0], [0.5], [0.0]). Positions are resolved by a quiescence search, and the
+ * tuner minimizes the squared error between the results and the win probabilities predicted by the
+ * eval of the resolved positions. Parameters are written to the output file after each iteration. */
+extern void tune(int argc, char **argv);
@@ -17,6 +17,7 @@
 #include <cmath>		// for std::abs()
 #include <cassert>
 #include <iostream>
+#include <string>
 
 // Square, Rank, File
 
@@ -86,6 +87,13 @@ struct Eval {
 
 typedef uint64_t Key, Bitboard;
 
+// A tunable eval parameter, and its range: see eval::params()
+struct Param {
+	std::string name;
+	int *value;
+	int min, max;
+};
+
 const int MATE = 16000;
 const int INF = 32767;
 
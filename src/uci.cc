@@ -13,26 +13,36 @@
  * see <http://www.gnu.org/licenses/>.
 */
 #include <sstream>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "uci.h"
 #include "search.h"
 #include "eval.h"
-#include "test.h"
-
-#if defined(_WIN32) || defined(_WIN64)
-#include <windows.h>
-#include <conio.h>
-#else   // assume POSIX
-#include <cerrno>
-#include <unistd.h>
-#include <sys/time.h>
-#endif
+#include "perft.h"
+#include "nnue.h"
+#include "book.h"
 
 namespace uci {
 
 int Hash = 16;
+bool BackgroundClear = false;
+int Threads = 1;
+int EvalCache = 256;
+int PawnCache = 2048;
+int MultiPV = 1;
 int Contempt = 25;
 bool Ponder = false;
 int TimeBuffer = 100;
+std::string TTFile = "discocheck.tt";
+std::string EvalFile;
+std::string EvalParams;
+bool OwnBook = false;
+std::string BookFile;
+
+std::mutex output_mtx;
 
 }	// namespace uci
 
@@ -47,9 +57,21 @@ void intro()
 		// Declare UCI options here
 		<< "option name Hash type spin default " << uci::Hash << " min 1 max 8192\n"
 		<< "option name Clear Hash type button\n"
+		<< "option name Background Clear type check default " << uci::BackgroundClear << '\n'
+		<< "option name TT File type string default " << uci::TTFile << '\n'
+		<< "option name Save TT type button\n"
+		<< "option name Load TT type button\n"
+		<< "option name Threads type spin default " << uci::Threads << " min 1 max 64\n"
+		<< "option name Eval Cache type spin default " << uci::EvalCache << " min 0 max 65536\n"
+		<< "option name Pawn Cache type spin default " << uci::PawnCache << " min 1 max 65536\n"
+		<< "option name MultiPV type spin default " << uci::MultiPV << " min 1 max 64\n"
 		<< "option name Contempt type spin default " << uci::Contempt << " min 0 max 100\n"
 		<< "option name Ponder type check default " << uci::Ponder << '\n'
 		<< "option name Time Buffer type spin default " << uci::TimeBuffer << " min 0 max 1000\n"
+		<< "option name EvalFile type string default <empty>\n"
+		<< "option name Eval Params type string default <empty>\n"
+		<< "option name OwnBook type check default " << uci::OwnBook << '\n'
+		<< "option name BookFile type string default <empty>\n"
 		// end of UCI options
 		<< "uciok" << std::endl;
 }
@@ -82,8 +104,17 @@ void go(board::Board& B, std::istringstream& is)
 {
 	search::Limits sl;
 	std::string token;
+	bool move_list = false, infinite = false;
 
 	while (is >> token) {
+		// searchmoves is followed by a list of moves, ended by the next keyword (if any)
+		if (move_list && token.size() >= 4 && token[0] >= 'a' && token[0] <= 'h'
+			&& token[1] >= '1' && token[1] <= '8') {
+			sl.searchmoves.push_back(move::string_to_move(B, token));
+			continue;
+		}
+		move_list = false;
+
 		if (token == (B.get_turn() ? "btime" : "wtime"))
 			is >> sl.time;
 		else if (token == (B.get_turn() ? "binc" : "winc"))
@@ -98,17 +129,33 @@ void go(board::Board& B, std::istringstream& is)
 			is >> sl.nodes;
 		else if (token == "ponder")
 			sl.ponder = true;
+		else if (token == "infinite")
+			infinite = true;
+		else if (token == "searchmoves")
+			move_list = true;
+	}
+
+	// book move: not when analysing, or when the GUI expects a search
+	if (uci::OwnBook && book::enabled() && !sl.ponder && !infinite && sl.searchmoves.empty()) {
+		const move::move_t m = book::pick(B);
+		if (m) {
+			std::lock_guard<std::mutex> lock(uci::output_mtx);
+			std::cout << "info string book move" << std::endl;
+			std::cout << "bestmove " << move_to_string(m) << std::endl;
+			return;
+		}
 	}
 
 	// best and ponder move
-	std::pair<move::move_t, move::move_t> best = bestmove(B, sl);
-	std::cout << "bestmove " << move_to_string(best.first);
-	if (best.second)
-		std::cout << " ponder " << move_to_string(best.second);
+	const search::Result r = search::engine.bestmove(B, sl);
+	std::lock_guard<std::mutex> lock(uci::output_mtx);
+	std::cout << "bestmove " << move_to_string(r.best);
+	if (r.ponder)
+		std::cout << " ponder " << move_to_string(r.ponder);
 	std::cout << std::endl;
 }
 
-void setoption(std::istringstream& is)
+void setoption(board::Board& B, std::istringstream& is)
 {
 	std::string token, name;
 	if (!(is >> token) || token != "name")
@@ -121,50 +168,149 @@ void setoption(std::istringstream& is)
 	if (name == "Hash")
 		is >> uci::Hash;
 	else if (name == "ClearHash")
-		search::clear_state();
+		search::engine.clear(uci::BackgroundClear);
+	else if (name == "BackgroundClear")
+		is >> uci::BackgroundClear;
+	else if (name == "TTFile")
+		getline(is >> std::ws, uci::TTFile);
+	else if (name == "SaveTT") {
+		if (search::engine.TT.save(uci::TTFile))
+			std::cout << "info string TT saved to " << uci::TTFile << std::endl;
+		else
+			std::cout << "info string cannot save TT to " << uci::TTFile << std::endl;
+	} else if (name == "LoadTT") {
+		if (search::engine.TT.load(uci::TTFile)) {
+			// a whole number of MB (at least MinSize), so that isready does not reallocate the table
+			uci::Hash = search::engine.TT.size() >> 20;
+			std::cout << "info string TT loaded from " << uci::TTFile << " (" << uci::Hash
+				<< " MB)" << std::endl;
+		} else
+			std::cout << "info string cannot load TT from " << uci::TTFile << std::endl;
+	}
+	else if (name == "Threads")
+		is >> uci::Threads;
+	else if (name == "EvalCache")
+		is >> uci::EvalCache;
+	else if (name == "PawnCache")
+		is >> uci::PawnCache;
+	else if (name == "MultiPV")
+		is >> uci::MultiPV;
 	else if (name == "Contempt")
 		is >> uci::Contempt;
 	else if (name == "Ponder")
 		is >> uci::Ponder;
 	else if (name == "TimeBuffer")
 		is >> uci::TimeBuffer;
+	else if (name == "EvalFile") {
+		getline(is >> std::ws, uci::EvalFile);
+		if (uci::EvalFile.empty() || uci::EvalFile == "<empty>") {
+			uci::EvalFile.clear();
+			nnue::clear();
+			std::cout << "info string using the classical eval" << std::endl;
+		} else if (nnue::load(uci::EvalFile))
+			std::cout << "info string network loaded from " << uci::EvalFile << std::endl;
+		else {
+			nnue::clear();
+			std::cout << "info string cannot load network from " << uci::EvalFile
+				<< ", using the classical eval" << std::endl;
+		}
+		// cached evals (TT and eval cache) come from the previous eval
+		search::engine.clear();
+	} else if (name == "EvalParams") {
+		getline(is >> std::ws, uci::EvalParams);
+		if (uci::EvalParams.empty() || uci::EvalParams == "<empty>") {
+			uci::EvalParams.clear();
+			eval::reset_params();
+		} else if (eval::load_params(uci::EvalParams))
+			std::cout << "info string eval parameters loaded from " << uci::EvalParams << std::endl;
+		else
+			std::cout << "info string cannot load eval parameters from " << uci::EvalParams << std::endl;
+		// the PSQ tables may have changed: recompute the incremental psq of the current position
+		B.set_fen(B.get_fen());
+		search::engine.clear();
+	} else if (name == "OwnBook")
+		is >> uci::OwnBook;
+	else if (name == "BookFile") {
+		getline(is >> std::ws, uci::BookFile);
+		if (uci::BookFile.empty() || uci::BookFile == "<empty>") {
+			uci::BookFile.clear();
+			book::close();
+		} else if (book::open(uci::BookFile))
+			std::cout << "info string book loaded from " << uci::BookFile << std::endl;
+		else
+			std::cout << "info string cannot load book from " << uci::BookFile << std::endl;
+	}
 }
 
-bool input_available()
-{
-#if defined(_WIN32) || defined(_WIN64)
-
-	static bool init = false, is_pipe;
-	static HANDLE stdin_h;
-	DWORD val;
+// Commands read by the input thread, waiting to be executed by the main thread
+std::deque<std::string> commands;
+std::mutex commands_mtx;
+std::condition_variable commands_cv;
 
-	if (!init) {
-		init = true;
-		stdin_h = GetStdHandle(STD_INPUT_HANDLE);
-		is_pipe = !GetConsoleMode(stdin_h, &val);
-	}
+/* go commands are numbered in the order they are read. stop and ponderhit apply to the last go read
+ * (go_read), which may not have started yet, or may be queued behind a search that has not seen
+ * the previous stop yet. So the main thread sets the signals when it starts executing a go, from
+ * stop_go and ponderhit_go. A search is pending while go_done < go_read. */
+std::atomic<int> go_read(0), go_done(0), stop_go(0), ponderhit_go(0);
 
-	if (stdin->_cnt > 0)
-		return true;
+void start_signals(int n)
+// Called by the main thread before executing the n-th go
+{
+	search::stop_signal = false;
+	search::ponderhit_signal = false;
+	// the input thread sets *_go before the signal: if it ran in between, the check below sees it
+	if (stop_go >= n)
+		search::stop_signal = true;
+	if (ponderhit_go >= n)
+		search::ponderhit_signal = true;
+}
 
-	if (is_pipe)
-		return !PeekNamedPipe(stdin_h, nullptr, 0, nullptr, &val, nullptr) ? true : val > 0;
-	else
-		return _kbhit();
+void read_input()
+/* Runs in its own thread, and owns stdin. stop and ponderhit are signaled to the search as soon as
+ * they are read, so that the search never needs to poll stdin. isready is answered right away
+ * during a search, as UCI requires, unless other commands are still waiting to be executed. All other
+ * commands are queued for the main loop. End of file is treated as quit. */
+{
+	std::string cmd, token;
 
-#else   // assume POSIX
+	do {
+		if (!getline(std::cin, cmd))
+			cmd = "quit";
 
-	fd_set readfds;
-	FD_ZERO(&readfds);
-	FD_SET(STDIN_FILENO, &readfds);
+		std::istringstream is(cmd);
+		token.clear();
+		is >> token;
+
+		if (token == "go")
+			++go_read;
+		else if (token == "stop" || token == "quit") {
+			stop_go = go_read.load();
+			search::stop_signal = true;
+		} else if (token == "ponderhit") {
+			ponderhit_go = go_read.load();
+			search::ponderhit_signal = true;
+		}
 
-	struct timeval timeout;
-	timeout.tv_sec = timeout.tv_usec = 0;
+		std::lock_guard<std::mutex> lock(commands_mtx);
+		if (token == "isready" && commands.empty() && go_done < go_read) {
+			// the main thread is in the last go: everything before it has been executed
+			std::lock_guard<std::mutex> out_lock(uci::output_mtx);
+			std::cout << "readyok" << std::endl;
+			continue;
+		}
+		commands.push_back(cmd);
+		commands_cv.notify_one();
+	} while (token != "quit");
+}
 
-	select(STDIN_FILENO + 1, &readfds, 0, 0, &timeout);
-	return FD_ISSET(STDIN_FILENO, &readfds);
+std::string next_command()
+{
+	std::unique_lock<std::mutex> lock(commands_mtx);
+	commands_cv.wait(lock, [] { return !commands.empty(); });
 
-#endif
+	const std::string cmd = commands.front();
+	commands.pop_front();
+	return cmd;
 }
 
 }	// namespace
@@ -174,12 +320,14 @@ namespace uci {
 void loop()
 {
 	board::Board B;
+	B.set_fen(StartFEN);	// until the first position command
 	std::string cmd, token;
 	std::cout << std::boolalpha;
 
+	std::thread input_thread(read_input);
+
 	while (token != "quit") {
-		if (!getline(std::cin, cmd) || cmd == "quit")
-			break;
+		cmd = next_command();
 
 		std::istringstream is(cmd);
 		is >> std::boolalpha;
@@ -187,47 +335,59 @@ void loop()
 		if (token == "uci")
 			intro();
 		else if (token == "ucinewgame")
-			search::clear_state();
+			search::engine.clear(BackgroundClear);
 		else if (token == "position")
 			position(B, is);
-		else if (token == "go")
+		else if (token == "go") {
+			start_signals(go_done + 1);
 			go(B, is);
+			++go_done;
+		}
 		else if (token == "isready") {
-			search::TT.alloc(Hash << 20);
+			// compare bytes: a loaded snapshot (same size as Hash) must not be resized
+			if (search::engine.TT.size() != (uint64_t)Hash << 20
+				&& search::engine.TT.alloc((uint64_t)Hash << 20, BackgroundClear))
+				std::cout << "info string Hash " << Hash << " MB: " << search::engine.TT.get_mode()
+					<< std::endl;
 			std::cout << "readyok" << std::endl;
 		} else if (token == "setoption")
-			setoption(is);
+			setoption(B, is);
 		else if (token == "eval") {
-			const int e = eval::symmetric_eval(B) + eval::asymmetric_eval(B, hanging_pieces(B));
+			eval::PawnCache PC;
+			eval::MaterialCache MC;
+			const int e = eval::symmetric_eval(B, PC, MC) + eval::asymmetric_eval(B, hanging_pieces(B));
 			std::cout << B << "eval = " << e << std::endl;
+			if (nnue::enabled())
+				std::cout << "network eval = " << nnue::evaluate(B) << std::endl;
+		} else if (token == "stats") {
+			if (search::Stats::Enabled)
+				std::cout << search::engine.stats() << std::endl;
+			else
+				std::cout << "info string search statistics are not compiled in (use -DSTATS)" << std::endl;
 		} else if (token == "perft") {
 			int depth;
 			if (is >> depth)
-				std::cout << perft(B, depth, 0) << std::endl;
+				std::cout << perft(B, depth, Threads, 16, true) << std::endl;
 		}
 	}
-}
-
-std::string check_input()
-{
-	std::string token;
-
-	if (input_available())
-		getline(std::cin, token);
 
-	return token;
+	input_thread.join();
 }
 
 void info::clear()
 {
-	score = depth = time = 0;
+	score = depth = seldepth = time = multipv = 0;
+	hashfull = -1;
 	nodes = 0;
 	bound = EXACT;
 }
 
 std::ostream& operator<< (std::ostream& ostrm, const info& ui)
 {
-	ostrm << "info score ";
+	ostrm << "info ";
+	if (ui.multipv)
+		ostrm << "multipv " << ui.multipv << ' ';
+	ostrm << "score ";
 	if (ui.bound == info::LBOUND)
 		ostrm << "lowerbound ";
 	else if (ui.bound == info::UBOUND)
@@ -240,9 +400,14 @@ std::ostream& operator<< (std::ostream& ostrm, const info& ui)
 	else
 		ostrm << "cp " << ui.score;
 	
-	ostrm << " depth " << ui.depth
-		<< " nodes " << ui.nodes
+	ostrm << " depth " << ui.depth;
+	if (ui.seldepth)
+		ostrm << " seldepth " << ui.seldepth;
+	ostrm << " nodes " << ui.nodes
+		<< " nps " << ui.nodes * 1000 / std::max(ui.time, 1)
 		<< " time " << ui.time;
+	if (ui.hashfull >= 0)
+		ostrm << " hashfull " << ui.hashfull;
 		
 	if (ui.bound == info::EXACT) {
 		ostrm << " pv";
@@ -13,19 +13,32 @@
  * see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include <mutex>
 #include <string>
 #include "move.h"
 
 namespace uci {
 
 extern void loop();
-extern std::string check_input();
+
+// Lines written to stdout by the search, and by the input thread (readyok while searching)
+extern std::mutex output_mtx;
 
 // UCI option values
 extern int Hash;
+extern bool BackgroundClear;
+extern int Threads;
+extern int EvalCache;
+extern int PawnCache;
+extern int MultiPV;
 extern int Contempt;
 extern bool Ponder;
 extern int TimeBuffer;
+extern std::string TTFile;
+extern std::string EvalFile;
+extern std::string EvalParams;
+extern bool OwnBook;
+extern std::string BookFile;
 
 struct info {
 	void clear();
@@ -33,7 +46,9 @@ struct info {
 	enum BoundType {EXACT, LBOUND, UBOUND};
 	BoundType bound;
 
-	int score, depth, time;
+	int score, depth, seldepth, time;
+	int multipv;	// line number, only displayed when > 0
+	int hashfull;	// permill, only displayed when >= 0
 	uint64_t nodes;
 	move::move_t *pv;
 };